@@ -0,0 +1,70 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#include <QGuiApplication>
+#include <QScreen>
+
+#include "Animation.h"
+
+Animation::Animation( void )
+    : _duration(0)
+    , _running(false)
+{
+}
+
+void Animation::start( int duration_ms, QEasingCurve::Type easing )
+{
+    _easing.setType( easing );
+    _duration = duration_ms > 0 ? duration_ms : 0;
+    _running = true;
+    _clock.start();
+}
+
+void Animation::restart( void )
+{
+    _running = true;
+    _clock.start();
+}
+
+void Animation::stop( void )
+{
+    _running = false;
+}
+
+bool Animation::isFinished( void ) const
+{
+    return !_running || _clock.elapsed() >= _duration;
+}
+
+double Animation::progress( void ) const
+{
+    if ( isFinished() )
+        return 1.0;
+    return _easing.valueForProgress( (double)_clock.elapsed() / _duration );
+}
+
+int Animation::frameInterval( void )
+{
+    QScreen * screen = QGuiApplication::primaryScreen();
+    qreal rate = screen ? screen->refreshRate() : 0.0;
+    if ( rate < 20.0 || rate > 500.0 )
+        rate = 60.0;
+    return qMax( 1, qRound( 1000.0 / rate ) );
+}
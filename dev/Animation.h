@@ -0,0 +1,71 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <QEasingCurve>
+#include <QElapsedTimer>
+
+/**
+ * Progress of a transition, computed from the monotonic clock.
+ *
+ * The state of an animation depends only on the time elapsed since it
+ * started, not on how many timer ticks were delivered: a late frame jumps
+ * ahead and the transition keeps its duration when the GUI thread is busy.
+ */
+
+class Animation
+{
+public:
+
+    Animation( void );
+
+    // starts from the beginning; a duration of 0 finishes at the first frame
+    void start( int duration_ms, QEasingCurve::Type easing = QEasingCurve::Linear );
+
+    // starts again from the beginning, with the same duration and easing
+    void restart( void );
+
+    void stop( void );
+
+    inline bool isRunning( void ) const
+    {
+        return _running;
+    }
+
+    // true once the duration has elapsed (the animation keeps running until stopped)
+    bool isFinished( void ) const;
+
+    // eased progress between 0.0 and 1.0
+    double progress( void ) const;
+
+    // interval between two display frames, in milliseconds
+    static int frameInterval( void );
+
+private:
+
+    QElapsedTimer _clock;
+    QEasingCurve _easing;
+    int _duration;
+    bool _running;
+};
+
+#endif // ANIMATION_H
@@ -0,0 +1,644 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#include "Benchmark.h"
+#include "Config.h"
+#include "ScreenDirectory.h"
+#include "ScreenViewer.h"
+#include "Metrics.h"
+#include "ExifReader.h"
+#include "ImageOrientation.h"
+#include "ImageScaler.h"
+#include "ImageLoadQueue.h"
+#include "SelfTest.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QPainter>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QTimer>
+#include <QWheelEvent>
+#include <algorithm>
+#include <stdio.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+#define BENCH_WIDTH 1280
+#define BENCH_HEIGHT 800
+#define BENCH_TIMEOUT_MS 600000
+#define BENCH_PAINT_FRAMES 200
+#define BENCH_VIEWER_STEPS 50
+#define BENCH_ORIENTATION_RUNS 10
+#define BENCH_SCALER_RUNS 10
+#define BENCH_QUEUE_VISIBLE 60
+#define BENCH_QUEUE_SCROLLS 1000
+
+#define STRINGIFY2(x) #x
+#define STRINGIFY(x) STRINGIFY2(x)
+
+int Benchmark::run( const QString & corpus, const QString & output, int count )
+{
+	// measure the pipeline itself: no shared thumbnails, no metadata index,
+	// and nothing written to the user cache
+	g_config.thumbnail_cache = false;
+	g_config.metadata_index = false;
+	g_config.show_folders = false;
+
+	QTemporaryDir tmp;
+	QString dir = corpus;
+	bool generated = dir.isEmpty();
+	if ( generated )
+	{
+		if ( !tmp.isValid() || !_generateCorpus( tmp.path(), count ) )
+		{
+			fprintf( stderr, "[ERROR] Cannot generate the benchmark images.\n" );
+			return 1;
+		}
+		dir = tmp.path();
+	}
+	dir = QDir( dir ).absolutePath();
+
+	QJsonObject corpus_info;
+	corpus_info["dir"] = generated ? QString("") : dir;
+	corpus_info["generated"] = generated;
+
+	QJsonObject grid = _benchGrid( dir );
+	QJsonObject viewer = _benchViewer( dir );
+	QJsonArray grid_scaling = _benchGridScaling( dir );
+	// the peak of the load pipeline, before the micro-benchmarks below
+	// allocate their synthetic images (ru_maxrss never goes down)
+	qint64 pipeline_rss = _peakRss();
+	corpus_info["files"] = grid["files"];
+
+	QJsonObject report;
+	report["version"] = QString( STRINGIFY(VERSION) );
+	report["load_threads"] = g_config.load_threads;
+	report["corpus"] = corpus_info;
+	report["grid"] = grid;
+	report["grid_scaling"] = grid_scaling;
+	report["viewer"] = viewer;
+	report["queue"] = _benchQueue();
+	report["exif"] = _benchExif( dir );
+	report["orientation"] = _benchOrientation();
+	bool scaler_ok = false;
+	report["scaler"] = _benchScaler( &scaler_ok );
+	report["metrics"] = Metrics::toJson();
+	report["peak_rss_kb"] = (double)pipeline_rss;
+	report["peak_rss_total_kb"] = (double)_peakRss();
+
+	QByteArray json = QJsonDocument( report ).toJson();
+	if ( output.isEmpty() )
+	{
+		fwrite( json.constData(), 1, json.size(), stdout );
+		fflush( stdout );
+	} else {
+		QFile f( output );
+		if ( !f.open( QIODevice::WriteOnly ) )
+		{
+			fprintf( stderr, "[ERROR] Cannot write %s\n", output.toUtf8().data() );
+			return 1;
+		}
+		f.write( json );
+	}
+
+	if ( !scaler_ok )
+	{
+		fprintf( stderr, "[ERROR] ImageScaler self-check failed, see \"scaler\" in the report.\n" );
+		return 1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* PRIVATE METHODS
+*******************************************************************************/
+
+bool Benchmark::_generateCorpus( const QString & dir, int count )
+{
+	// 6 MP photos with smooth gradients and some detail, so the
+	// JPEG decoder has realistic work to do
+	for ( int i = 0; i < count; i++ )
+	{
+		QImage img( 3000, 2000, QImage::Format_RGB32 );
+		for ( int y = 0; y < img.height(); y++ )
+		{
+			QRgb * line = (QRgb*)img.scanLine( y );
+			for ( int x = 0; x < img.width(); x++ )
+			{
+				int v = ( x * 7 + y * 13 + i * 31 ) ^ ( ( x >> 3 ) * ( y >> 3 ) );
+				line[x] = qRgb( ( x + i * 17 ) & 255, ( y + v ) & 255, v & 255 );
+			}
+		}
+		QString name = QString( "%1/bench-%2.jpg" ).arg( dir ).arg( i, 5, 10, QChar('0') );
+		if ( !img.save( name, "JPEG", 90 ) )
+			return false;
+	}
+	return true;
+}
+
+QJsonObject Benchmark::_benchGrid( const QString & dir )
+{
+	// room for every thumbnail, so the whole folder is loaded
+	QStringList files = QDir( dir ).entryList( QDir::Files );
+	g_config.thumbnail_memory = qMax( g_config.thumbnail_memory, files.size() * 2 );
+
+	ScreenDirectory grid;
+	grid.setSize( BENCH_WIDTH, BENCH_HEIGHT );
+	grid.onResize();
+
+	QVector<qint64> decode_us;
+	QObject::connect( &grid.loadThread(), &ImageLoadThread::imageLoaded, &grid,
+		[&decode_us]( ImageLoadResult r ) { decode_us.append( r.load_time ); },
+		Qt::QueuedConnection );
+
+	QImage frame( BENCH_WIDTH, BENCH_HEIGHT, QImage::Format_ARGB32_Premultiplied );
+	const ThumbnailStore & thumbs = grid.thumbnailStore();
+
+	QElapsedTimer timer;
+	timer.start();
+	grid.loadFiles( dir, "" );
+
+	// the folder view requests the visible thumbnails when painting
+	auto paint = [&]() {
+		QPainter painter( &frame );
+		grid.onPaint( painter );
+	};
+	auto done_count = [&]() {
+		int n = 0;
+		for ( int i = 0; i < thumbs.count(); i++ )
+			if ( thumbs.state( i ) == ThumbnailStore::RESIDENT || thumbs.state( i ) == ThumbnailStore::FAILED )
+				n++;
+		return n;
+	};
+
+	// repaint at most once per frame (60 Hz), like the window does
+	qint64 first_ms = -1;
+	qint64 painted_ms = -100;
+	_waitFor( [&]() {
+		if ( timer.elapsed() - painted_ms >= 16 )
+		{
+			paint();
+			painted_ms = timer.elapsed();
+		}
+		if ( first_ms < 0 && thumbs.residentCount() > 0 )
+			first_ms = timer.elapsed();
+		return !grid.isScanning() && done_count() == grid.getFiles().size();
+	}, BENCH_TIMEOUT_MS );
+	qint64 full_ms = timer.elapsed();
+	int n = grid.getFiles().size();
+
+	// frame time of the complete grid
+	QVector<qint64> paint_us;
+	for ( int i = 0; i < BENCH_PAINT_FRAMES; i++ )
+	{
+		QElapsedTimer t;
+		t.start();
+		paint();
+		paint_us.append( t.nsecsElapsed() / 1000 );
+	}
+
+	// frame time while scrolling down with the wheel and back up; the rows
+	// that come into view are drawn once, then only copied
+	QVector<qint64> scroll_us;
+	for ( int i = 0; i < BENCH_PAINT_FRAMES; i++ )
+	{
+		QPoint angle( 0, i < BENCH_PAINT_FRAMES / 2 ? -120 : 120 );
+		QWheelEvent wheel( QPointF(), QPointF(), QPoint(), angle, Qt::NoButton, Qt::NoModifier,
+			Qt::NoScrollPhase, false );
+		grid.onWheel( &wheel );
+		grid.onTimer();
+		QElapsedTimer t;
+		t.start();
+		paint();
+		scroll_us.append( t.nsecsElapsed() / 1000 );
+	}
+
+	QJsonObject o;
+	o["files"] = n;
+	o["time_to_first_thumbnail_ms"] = (double)first_ms;
+	o["time_to_full_grid_ms"] = (double)full_ms;
+	o["files_per_s"] = full_ms > 0 ? n * 1000.0 / full_ms : 0.0;
+	o["decode_us"] = _percentiles( decode_us );
+	o["paint_us"] = _percentiles( paint_us );
+	o["scroll_paint_us"] = _percentiles( scroll_us );
+	return o;
+}
+
+QJsonArray Benchmark::_benchGridScaling( const QString & dir )
+{
+	// the full grid again with 1, 2, 4... workers up to one per core
+	int configured = g_config.load_threads;
+	int cores = qMax( QThread::idealThreadCount(), 1 );
+	QVector<int> counts;
+	for ( int n = 1; n < cores; n *= 2 )
+		counts.append( n );
+	counts.append( cores );
+
+	QJsonArray a;
+	double single_ms = 0.0;
+	for ( int c = 0; c < counts.size(); c++ )
+	{
+		g_config.load_threads = counts[c];
+		QJsonObject grid = _benchGrid( dir );
+		double ms = grid["time_to_full_grid_ms"].toDouble();
+		if ( c == 0 )
+			single_ms = ms;
+		QJsonObject r;
+		r["load_threads"] = counts[c];
+		r["time_to_full_grid_ms"] = ms;
+		r["files_per_s"] = grid["files_per_s"];
+		r["speedup"] = ms > 0 ? single_ms / ms : 0.0;
+		a.append( r );
+	}
+	g_config.load_threads = configured;
+	return a;
+}
+
+QJsonObject Benchmark::_benchViewer( const QString & dir )
+{
+	ScreenViewer viewer;
+	viewer.setSize( BENCH_WIDTH, BENCH_HEIGHT );
+	viewer.onResize();
+
+	QVector<qint64> decode_us;
+	QObject::connect( &viewer.loadThread(), &ImageLoadThread::imageLoaded, &viewer,
+		[&decode_us]( ImageLoadResult r ) { if ( !r.preview ) decode_us.append( r.load_time ); },
+		Qt::QueuedConnection );
+
+	// open the first file as from the command line
+	QStringList files = QDir( dir ).entryList( QDir::Files, QDir::Name | QDir::IgnoreCase );
+	QElapsedTimer timer;
+	timer.start();
+	viewer.loadFiles( dir, files.isEmpty() ? QString("") : files[0] );
+	_waitFor( [&]() { return viewer.isReady(); }, BENCH_TIMEOUT_MS );
+	qint64 first_ms = timer.elapsed();
+	_waitFor( [&]() { return !viewer.isScanning(); }, BENCH_TIMEOUT_MS );
+
+	// browse forward one image at a time, as fast as the images are ready;
+	// the prefetched neighbours should be instant
+	QVector<qint64> step_us;
+	int steps = qMin( BENCH_VIEWER_STEPS, viewer.getFiles().size() - 1 );
+	for ( int i = 0; i < steps; i++ )
+	{
+		QElapsedTimer t;
+		t.start();
+		viewer.forward();
+		_waitFor( [&]() { return viewer.isReady(); }, BENCH_TIMEOUT_MS );
+		step_us.append( t.nsecsElapsed() / 1000 );
+	}
+
+	QJsonObject o;
+	o["time_to_first_image_ms"] = (double)first_ms;
+	o["steps"] = steps;
+	o["step_us"] = _percentiles( step_us );
+	o["decode_us"] = _percentiles( decode_us );
+	return o;
+}
+
+QJsonObject Benchmark::_benchQueue( void )
+{
+	// a huge folder queued at once, then scrolled through: the visible
+	// range is boosted at every frame, and the priorities dropped when
+	// the grid is left
+	static const int sizes[] = { 100000, 1000000 };
+	QJsonObject o;
+	for ( unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++ )
+	{
+		int n = sizes[s];
+		ImageLoadQueue queue;
+		ImageLoadItem item;
+		item.name = "bench.jpg";
+		QElapsedTimer t;
+
+		t.start();
+		for ( int i = 0; i < n; i++ )
+		{
+			item.index = i;
+			queue.push( item );
+		}
+		double push_ns = (double)t.nsecsElapsed() / n;
+
+		QVector<int> visible( BENCH_QUEUE_VISIBLE );
+		t.start();
+		for ( int k = 0; k < BENCH_QUEUE_SCROLLS; k++ )
+		{
+			int first = (int)( (qint64)k * ( n - BENCH_QUEUE_VISIBLE ) / BENCH_QUEUE_SCROLLS );
+			for ( int i = 0; i < BENCH_QUEUE_VISIBLE; i++ )
+				visible[i] = first + i;
+			queue.reprioritize( visible, n );
+		}
+		double reprioritize_us = t.nsecsElapsed() / 1e3 / BENCH_QUEUE_SCROLLS;
+
+		t.start();
+		queue.clearPriorities();
+		double clear_priorities_us = t.nsecsElapsed() / 1e3;
+
+		t.start();
+		for ( int i = 0; i < n; i++ )
+			queue.popWithPriority();
+		double pop_ns = (double)t.nsecsElapsed() / n;
+
+		QJsonObject r;
+		r["push_ns"] = push_ns;
+		r["reprioritize_us"] = reprioritize_us;
+		r["clear_priorities_us"] = clear_priorities_us;
+		r["pop_ns"] = pop_ns;
+		o[QString::number( n )] = r;
+	}
+	return o;
+}
+
+QJsonObject Benchmark::_benchExif( const QString & dir )
+{
+	// metadata of every file of the corpus, read by ExifReader and by the
+	// old scan (which goes through the whole file when there is no
+	// orientation tag); the first pass warms the page cache
+	QStringList files = QDir( dir ).entryList( QDir::Files, QDir::Name | QDir::IgnoreCase );
+	QVector<qint64> reader_us, legacy_us;
+	int differ = 0;
+	for ( int pass = 0; pass < 2; pass++ )
+	{
+		for ( int i = 0; i < files.size(); i++ )
+		{
+			QString fullname = dir + "/" + files[i];
+			QElapsedTimer t;
+			t.start();
+			ExifInfo info;
+			ExifReader::read( fullname, info );
+			qint64 reader = t.nsecsElapsed() / 1000;
+
+			t.start();
+			int orientation = _legacyExifOrientation( fullname );
+			qint64 legacy = t.nsecsElapsed() / 1000;
+
+			if ( pass == 0 )
+				continue;
+			reader_us.append( reader );
+			legacy_us.append( legacy );
+			if ( orientation != info.orientation )
+				differ++;
+		}
+	}
+
+	QJsonObject o;
+	o["files"] = files.size();
+	o["reader_us"] = _percentiles( reader_us );
+	o["legacy_scan_us"] = _percentiles( legacy_us );
+	o["orientation_differs"] = differ;
+	return o;
+}
+
+QJsonObject Benchmark::_benchOrientation( void )
+{
+	// a decoded 6 MP photo turned by QImage::transformed(), as the loader
+	// did before, and by ImageOrientation (which works in place, so it gets
+	// a fresh copy each run, outside the timing)
+	QImage src( 3000, 2000, QImage::Format_RGB32 );
+	for ( int y = 0; y < src.height(); y++ )
+	{
+		QRgb * line = (QRgb*)src.scanLine( y );
+		for ( int x = 0; x < src.width(); x++ )
+			line[x] = qRgb( x & 255, y & 255, ( x ^ y ) & 255 );
+	}
+
+	QJsonObject o;
+	for ( int orientation = 2; orientation <= 8; orientation++ )
+	{
+		qreal rotation;
+		bool mirror;
+		ExifReader::orientationTransform( orientation, &rotation, &mirror );
+		QTransform tr;
+		if ( mirror )
+			tr.scale(-1.0, 1.0);
+		tr.rotate(rotation);
+
+		QVector<qint64> transformed_us, lossless_us;
+		for ( int i = 0; i < BENCH_ORIENTATION_RUNS; i++ )
+		{
+			QElapsedTimer t;
+			t.start();
+			QImage a = src.transformed( tr, g_config.smooth_images ? Qt::SmoothTransformation : Qt::FastTransformation );
+			transformed_us.append( t.nsecsElapsed() / 1000 );
+
+			QImage b = src.copy();
+			t.start();
+			ImageOrientation::apply( b, orientation );
+			lossless_us.append( t.nsecsElapsed() / 1000 );
+		}
+
+		QJsonObject r;
+		r["transformed_us"] = _percentiles( transformed_us );
+		r["lossless_us"] = _percentiles( lossless_us );
+		o[QString::number( orientation )] = r;
+	}
+	return o;
+}
+
+QJsonObject Benchmark::_benchScaler( bool * ok )
+{
+	double max_error = 0.0;
+	*ok = SelfTest::scaler( max_error );
+
+	// throughput on a 12 MP photo, to a grid thumbnail and to the screen
+	QImage photo = SelfTest::noiseImage( 4000, 3000, QImage::Format_RGB32 );
+	double mpix = photo.width() * photo.height() / 1e6;
+	QJsonObject targets;
+	static const int sizes[][2] = { { 256, 192 }, { BENCH_HEIGHT * 4 / 3, BENCH_HEIGHT } };
+	for ( int s = 0; s < 2; s++ )
+	{
+		int w = sizes[s][0];
+		int h = sizes[s][1];
+		QJsonObject t;
+		QElapsedTimer timer;
+		timer.start();
+		for ( int i = 0; i < BENCH_SCALER_RUNS; i++ )
+			photo.scaled( w, h, Qt::IgnoreAspectRatio, Qt::SmoothTransformation );
+		double secs = timer.nsecsElapsed() / 1e9 / BENCH_SCALER_RUNS;
+		t["qt_smooth"] = secs > 0 ? mpix / secs : 0.0;
+
+		for ( int k = 0; k < ImageScaler::KERNEL_COUNT; k++ )
+		{
+			ImageScaler::Kernel kernel = (ImageScaler::Kernel)k;
+			if ( !ImageScaler::isSupported( kernel ) )
+				continue;
+			timer.restart();
+			for ( int i = 0; i < BENCH_SCALER_RUNS; i++ )
+				ImageScaler::downscale( photo, w, h, kernel );
+			secs = timer.nsecsElapsed() / 1e9 / BENCH_SCALER_RUNS;
+			t[QString( ImageScaler::kernelName( kernel ) )] = secs > 0 ? mpix / secs : 0.0;
+		}
+		targets[QString( "%1x%2_mpix_per_s" ).arg( w ).arg( h )] = t;
+	}
+
+	// striped render of a 24 MP photo fit to a 5K screen, by thread count;
+	// the image must not depend on the number of threads
+	QImage big = SelfTest::noiseImage( 6000, 4000, QImage::Format_RGB32 );
+	QImage single;
+	double single_ms = 0.0;
+	QJsonArray stripes;
+	int cores = qMax( QThread::idealThreadCount(), 1 );
+	QVector<int> counts;
+	for ( int n = 1; n < cores; n *= 2 )
+		counts.append( n );
+	counts.append( cores );
+	for ( int c = 0; c < counts.size(); c++ )
+	{
+		int threads = counts[c];
+		QImage result;
+		QElapsedTimer timer;
+		timer.start();
+		for ( int i = 0; i < BENCH_SCALER_RUNS; i++ )
+			result = ImageScaler::downscale( big, 4320, 2880, ImageScaler::bestKernel(), threads );
+		double ms = timer.nsecsElapsed() / 1e6 / BENCH_SCALER_RUNS;
+		if ( threads == 1 )
+		{
+			single = result;
+			single_ms = ms;
+		} else if ( result != single ) {
+			fprintf( stderr, "[ERROR] downscale with %d threads differs from one thread\n", threads );
+			*ok = false;
+		}
+
+		QJsonObject t;
+		t["threads"] = threads;
+		t["ms"] = ms;
+		t["speedup"] = ms > 0 ? single_ms / ms : 0.0;
+		stripes.append( t );
+	}
+
+	QJsonObject o;
+	o["kernel"] = QString( ImageScaler::kernelName( ImageScaler::bestKernel() ) );
+	o["self_check"] = *ok;
+	o["max_error"] = max_error;
+	o["throughput"] = targets;
+	o["stripes_6000x4000_to_4320x2880"] = stripes;
+	return o;
+}
+
+bool Benchmark::_waitFor( std::function<bool()> done, int timeout_ms )
+{
+	// the timer wakes the loop up when no result arrives
+	QTimer tick;
+	tick.start( 5 );
+	QElapsedTimer timer;
+	timer.start();
+	while ( !done() )
+	{
+		if ( timer.elapsed() > timeout_ms )
+			return false;
+		QCoreApplication::processEvents( QEventLoop::WaitForMoreEvents );
+	}
+	return true;
+}
+
+QJsonObject Benchmark::_percentiles( QVector<qint64> values )
+{
+	QJsonObject o;
+	o["count"] = values.size();
+	if ( values.isEmpty() )
+		return o;
+	std::sort( values.begin(), values.end() );
+	int n = values.size();
+	o["p50"] = (double)values[n * 50 / 100];
+	o["p90"] = (double)values[n * 90 / 100];
+	o["p99"] = (double)values[n * 99 / 100];
+	o["max"] = (double)values[n - 1];
+	return o;
+}
+
+int Benchmark::_legacyExifOrientation( const QString & fullname )
+{
+	// ImageLoadThread::_getExifRotation() before ExifReader, orientation only
+	if ( !fullname.endsWith(".jpg", Qt::CaseInsensitive) && !fullname.endsWith(".jpeg", Qt::CaseInsensitive) )
+		return 1;
+
+	QFile f( fullname );
+	quint16 orientation = 1;
+	if ( f.open(QIODevice::ReadOnly))
+	{
+		unsigned short w;
+		bool in_exif = false;
+		quint16 type = 0;
+		quint32 len = 0;
+		quint8 last_byte = 0, current_byte;
+		bool full_word = false;
+		while ( f.read((char*)&current_byte, sizeof(current_byte)) )
+		{
+			if ( !full_word )
+			{
+				last_byte = current_byte;
+				full_word = true;
+				continue;
+			}
+			w = ( current_byte << 8 ) | last_byte;
+			if ( in_exif )
+			{
+				if ( current_byte == 0xFF )
+				{
+					in_exif = false;
+					full_word = false;
+				} else if ( w == 0x0112 ) {
+					f.read((char*)&type, sizeof(type)) > 0
+						&& f.read((char*)&len, sizeof(len)) > 0
+						&& f.read((char*)&orientation, sizeof(orientation)) > 0;
+					break;
+				} else if ( w == 0x1201 ) {
+					f.read((char*)&type, sizeof(type)) > 0
+						&& f.read((char*)&len, sizeof(len)) > 0
+						&& f.read((char*)&orientation, sizeof(orientation)) > 0;
+					orientation = ( ( orientation >> 8 ) & 0xFF ) | ( ( orientation << 8 ) & 0xFF00 );
+					break;
+				}
+			} else {
+				if ( w == 0xE1FF || w == 0xFFE1 )
+				{
+					in_exif = true;
+					full_word = false;
+				}
+			}
+			last_byte = current_byte;
+		}
+		f.close();
+	}
+	return orientation >= 1 && orientation <= 8 ? orientation : 1;
+}
+
+qint64 Benchmark::_peakRss( void )
+{
+#ifdef Q_OS_UNIX
+	struct rusage usage;
+	if ( getrusage( RUSAGE_SELF, &usage ) == 0 )
+	{
+#ifdef Q_OS_MAC
+		return usage.ru_maxrss / 1024; // bytes on OS X
+#else
+		return usage.ru_maxrss;
+#endif
+	}
+#endif
+	return 0;
+}
@@ -0,0 +1,67 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QString>
+#include <QVector>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QImage>
+#include <functional>
+
+/**
+ * Headless benchmark of the load pipeline (--bench).
+ *
+ * Drives a folder view and an image viewer on the offscreen platform over
+ * a folder of photos (or over generated ones) and writes the timings as
+ * JSON, so the numbers of two releases can be compared with diff.
+ */
+
+class Benchmark
+{
+public:
+
+	// corpus: folder of images, empty to generate count images;
+	// output: file for the report, empty for stdout; returns the exit code
+	static int run( const QString & corpus, const QString & output, int count );
+
+private:
+
+	static bool _generateCorpus( const QString & dir, int count );
+	static QJsonObject _benchGrid( const QString & dir );
+	static QJsonArray _benchGridScaling( const QString & dir );
+	static QJsonObject _benchViewer( const QString & dir );
+	static QJsonObject _benchQueue( void );
+	static QJsonObject _benchExif( const QString & dir );
+	static QJsonObject _benchOrientation( void );
+	static QJsonObject _benchScaler( bool * ok );
+
+	// processes events until done() or the timeout, returns done()
+	static bool _waitFor( std::function<bool()> done, int timeout_ms );
+	static QJsonObject _percentiles( QVector<qint64> values );
+	static qint64 _peakRss( void );
+
+	// the byte-by-byte orientation scan ExifReader replaced
+	static int _legacyExifOrientation( const QString & fullname );
+};
+
+#endif // BENCHMARK_H
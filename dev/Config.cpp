@@ -69,6 +69,15 @@ void Config::loadDefaults( void )
     choose_ui_size = 0;
     ui_size = 48;
     allow_rotation = false;
+    load_threads = 0;
+    thumbnail_cache = true;
+    embedded_previews = true;
+    thumbnail_memory = 256;
+    metadata_index = true;
+    prefetch_ahead = 3;
+    prefetch_behind = 1;
+    viewer_memory = 512;
+    render_threads = 0;
     multitouch = true;
     max_zoom = 10.0;
 
@@ -129,6 +138,15 @@ bool Config::save()
         ts << "disable_animations = " << _fromBool(disable_animations) << "\n";
         ts << "choose_ui_size = " << choose_ui_size << "\n";
         ts << "allow_rotation = " << allow_rotation << "\n";
+        ts << "load_threads = " << load_threads << "\n";
+        ts << "thumbnail_cache = " << _fromBool(thumbnail_cache) << "\n";
+        ts << "embedded_previews = " << _fromBool(embedded_previews) << "\n";
+        ts << "thumbnail_memory = " << thumbnail_memory << "\n";
+        ts << "metadata_index = " << _fromBool(metadata_index) << "\n";
+        ts << "prefetch_ahead = " << prefetch_ahead << "\n";
+        ts << "prefetch_behind = " << prefetch_behind << "\n";
+        ts << "viewer_memory = " << viewer_memory << "\n";
+        ts << "render_threads = " << render_threads << "\n";
         f.close();
         return true;
     }
@@ -235,6 +253,34 @@ bool Config::load()
             {
                 allow_rotation = _toBool(value);
             }
+            else if ( key == "load_threads" )
+            {
+                load_threads = value.toInt();
+                if ( load_threads < 0 ) load_threads = 0;
+                if ( load_threads > 64 ) load_threads = 64;
+            }
+            else if ( key == "thumbnail_cache" )
+                thumbnail_cache = _toBool(value);
+            else if ( key == "embedded_previews" )
+                embedded_previews = _toBool(value);
+            else if ( key == "thumbnail_memory" )
+            {
+                thumbnail_memory = value.toInt();
+                if ( thumbnail_memory < 16 ) thumbnail_memory = 16;
+            }
+            else if ( key == "metadata_index" )
+                metadata_index = _toBool(value);
+            else if ( key == "prefetch_ahead" )
+                prefetch_ahead = qBound( 1, value.toInt(), 16 );
+            else if ( key == "prefetch_behind" )
+                prefetch_behind = qBound( 1, value.toInt(), 16 );
+            else if ( key == "viewer_memory" )
+            {
+                viewer_memory = value.toInt();
+                if ( viewer_memory < 64 ) viewer_memory = 64;
+            }
+            else if ( key == "render_threads" )
+                render_threads = qBound( 0, value.toInt(), 64 );
 
             // else => ignore unknown key
             f.close();
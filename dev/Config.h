@@ -64,6 +64,15 @@ struct Config
 	bool disable_animations;
 	int choose_ui_size;
 	bool allow_rotation;
+	int load_threads; // number of image loading threads (0 = one per core)
+	bool thumbnail_cache; // use the shared freedesktop.org thumbnail cache
+	bool embedded_previews; // use JPEG previews embedded by cameras for thumbnails
+	int thumbnail_memory; // memory budget for the thumbnails of a folder (MB)
+	bool metadata_index; // remember the image metadata of each folder on disk
+	int prefetch_ahead; // images decoded in advance in the browsing direction
+	int prefetch_behind; // and in the opposite direction
+	int viewer_memory; // memory budget for the decoded images of the viewer (MB)
+	int render_threads; // threads for the smooth rendering of the current image (0 = one per core)
 
 	// not persistent
 	QString current_dir;
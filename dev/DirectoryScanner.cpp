@@ -0,0 +1,224 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#include "DirectoryScanner.h"
+
+#include <QFile>
+#include <QElapsedTimer>
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <dirent.h>
+#include <sys/stat.h>
+#else
+#include <QDirIterator>
+#endif
+
+#define FIRST_BATCH_SIZE 256
+#define MAX_BATCH_SIZE 65536
+#define MAX_BATCH_DELAY_MS 100
+
+DirectoryScanner::DirectoryScanner( void ) : QObject()
+{
+	_generation = 0;
+}
+
+DirectoryScanner::~DirectoryScanner( void )
+{
+	stop();
+}
+
+int DirectoryScanner::scan( const QString & dir )
+{
+	stop();
+	_generation++;
+	_job = new DirectoryScanJob( dir, _generation );
+	connect( _job, SIGNAL(batch(int,QStringList,QStringList)),
+		this, SIGNAL(batch(int,QStringList,QStringList)) );
+	connect( _job, SIGNAL(scanFinished(int)), this, SIGNAL(scanFinished(int)) );
+	connect( _job, SIGNAL(finished()), _job, SLOT(deleteLater()) );
+	_job->start();
+	return _generation;
+}
+
+void DirectoryScanner::stop( void )
+{
+	if ( _job.isNull() )
+		return;
+	_job->disconnect( this );
+	_job->stop();
+	_job = NULL;
+}
+
+bool DirectoryScanner::lessThan( const QString & a, const QString & b )
+{
+	int c = QString::compare( a, b, Qt::CaseInsensitive );
+	if ( c != 0 )
+		return c < 0;
+	return a < b;
+}
+
+void DirectoryScanner::merge( QStringList & list, const QStringList & batch,
+	QVector<int> * old_to_new )
+{
+	if ( old_to_new != NULL )
+		old_to_new->resize( list.size() );
+
+	QStringList result;
+	result.reserve( list.size() + batch.size() );
+	int i = 0, j = 0;
+	while ( i < list.size() || j < batch.size() )
+	{
+		if ( j >= batch.size() || ( i < list.size() && !lessThan( batch[j], list[i] ) ) )
+		{
+			if ( old_to_new != NULL )
+				(*old_to_new)[i] = result.size();
+			result.append( list[i++] );
+		} else {
+			result.append( batch[j++] );
+		}
+	}
+	list = result;
+}
+
+int DirectoryScanner::find( const QStringList & list, const QString & name )
+{
+	QStringList::const_iterator it = std::lower_bound( list.constBegin(), list.constEnd(),
+		name, DirectoryScanner::lessThan );
+	if ( it == list.constEnd() || *it != name )
+		return -1;
+	return (int)( it - list.constBegin() );
+}
+
+bool DirectoryScanner::isImageName( const QString & name )
+{
+	static const char * extensions[] = { ".jpg", ".jpeg", ".png", ".bmp", ".tif", ".gif" };
+	for ( unsigned i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++ )
+		if ( name.endsWith( QLatin1String(extensions[i]), Qt::CaseInsensitive ) )
+			return true;
+	return false;
+}
+
+/*******************************************************************************
+* PRIVATE METHODS
+*******************************************************************************/
+
+DirectoryScanJob::DirectoryScanJob( const QString & dir, int generation ) : QThread()
+{
+	_dir = dir;
+	_generation = generation;
+}
+
+void DirectoryScanJob::stop( void )
+{
+	_stop.storeRelaxed( 1 );
+}
+
+void DirectoryScanJob::run()
+{
+	int batch_size = FIRST_BATCH_SIZE;
+	QStringList files, folders;
+	QElapsedTimer timer;
+	timer.start();
+
+#ifdef Q_OS_UNIX
+	QByteArray path = QFile::encodeName( _dir );
+	DIR * d = opendir( path.constData() );
+	if ( d != NULL )
+	{
+		struct dirent * e;
+		while ( !_stopped() && ( e = readdir( d ) ) != NULL )
+		{
+			// hidden entries, "." and ".." are not listed
+			if ( e->d_name[0] == '.' )
+				continue;
+
+			bool is_dir = false, is_file = false;
+#ifdef _DIRENT_HAVE_D_TYPE
+			is_dir = ( e->d_type == DT_DIR );
+			is_file = ( e->d_type == DT_REG );
+			if ( e->d_type == DT_UNKNOWN || e->d_type == DT_LNK )
+#endif
+			{
+				struct stat st;
+				QByteArray full = path + '/' + e->d_name;
+				if ( stat( full.constData(), &st ) == 0 )
+				{
+					is_dir = S_ISDIR( st.st_mode );
+					is_file = S_ISREG( st.st_mode );
+				}
+			}
+
+			if ( is_dir )
+			{
+				folders.append( QFile::decodeName( e->d_name ) );
+			} else if ( is_file ) {
+				QString name = QFile::decodeName( e->d_name );
+				if ( isImageName( name ) )
+					files.append( name );
+			}
+
+			if ( files.size() + folders.size() >= batch_size
+				|| ( timer.elapsed() > MAX_BATCH_DELAY_MS && !( files.isEmpty() && folders.isEmpty() ) ) )
+			{
+				_send( files, folders );
+				batch_size = qMin( batch_size * 2, MAX_BATCH_SIZE );
+				timer.restart();
+			}
+		}
+		closedir( d );
+	}
+#else
+	QDirIterator it( _dir, QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot );
+	while ( !_stopped() && it.hasNext() )
+	{
+		it.next();
+		QFileInfo info = it.fileInfo();
+		if ( info.isDir() )
+			folders.append( it.fileName() );
+		else if ( isImageName( it.fileName() ) )
+			files.append( it.fileName() );
+
+		if ( files.size() + folders.size() >= batch_size
+			|| ( timer.elapsed() > MAX_BATCH_DELAY_MS && !( files.isEmpty() && folders.isEmpty() ) ) )
+		{
+			_send( files, folders );
+			batch_size = qMin( batch_size * 2, MAX_BATCH_SIZE );
+			timer.restart();
+		}
+	}
+#endif
+
+	if ( _stopped() )
+		return;
+	if ( !files.isEmpty() || !folders.isEmpty() )
+		_send( files, folders );
+	emit scanFinished( _generation );
+}
+
+void DirectoryScanJob::_send( QStringList & files, QStringList & folders )
+{
+	// sorting here keeps the GUI thread to a linear merge
+	std::sort( files.begin(), files.end(), DirectoryScanner::lessThan );
+	std::sort( folders.begin(), folders.end(), DirectoryScanner::lessThan );
+	emit batch( _generation, files, folders );
+	files.clear();
+	folders.clear();
+}
@@ -0,0 +1,122 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#ifndef DIRECTORYSCANNER_H
+#define DIRECTORYSCANNER_H
+
+#include <QThread>
+#include <QPointer>
+#include <QStringList>
+#include <QVector>
+#include <QAtomicInt>
+
+/**
+ * Thread listing one folder for DirectoryScanner. A stopped job is left
+ * to end on its own (it may be stuck in a stat() on a slow mount) and
+ * deletes itself when it does.
+ */
+
+class DirectoryScanJob : public QThread
+{
+	Q_OBJECT
+
+private:
+
+	QString _dir;
+	int _generation;
+	QAtomicInt _stop;
+
+public:
+
+	DirectoryScanJob( const QString & dir, int generation );
+
+	// sends nothing more (what was sent before is told apart by the
+	// generation); returns at once
+	void stop( void );
+
+signals:
+
+	void batch( int generation, QStringList files, QStringList folders );
+	void scanFinished( int generation );
+
+protected:
+
+	void run();
+
+private:
+
+	inline bool _stopped( void ) const
+	{
+		return _stop.loadRelaxed() != 0;
+	}
+
+	void _send( QStringList & files, QStringList & folders );
+};
+
+/**
+ * Lists a folder in the background, in a single pass.
+ *
+ * Entries are classified as images or folders from the directory entry type
+ * (no stat() unless the file system does not report it) and sent in sorted
+ * batches of growing size, so the receiver can show the first items at once
+ * and merging the batches costs O(n log n) in total.
+ */
+
+class DirectoryScanner : public QObject
+{
+	Q_OBJECT
+
+private:
+
+	QPointer<DirectoryScanJob> _job;
+	int _generation;
+
+public:
+
+	DirectoryScanner( void );
+	~DirectoryScanner( void );
+
+	// stops the running scan (if any) and starts listing dir,
+	// returns the generation sent with the signals of this scan
+	int scan( const QString & dir );
+
+	// the running scan sends nothing more; never waits for its thread
+	void stop( void );
+
+	// order of the file lists (case insensitive, ties broken by case)
+	static bool lessThan( const QString & a, const QString & b );
+
+	// merges the sorted batch into the sorted list; old_to_new receives
+	// the new position of every item that was already in list
+	static void merge( QStringList & list, const QStringList & batch,
+		QVector<int> * old_to_new = NULL );
+
+	// index of name in a sorted list, or -1
+	static int find( const QStringList & list, const QString & name );
+
+	static bool isImageName( const QString & name );
+
+signals:
+
+	void batch( int generation, QStringList files, QStringList folders );
+	void scanFinished( int generation );
+};
+
+#endif // DIRECTORYSCANNER_H
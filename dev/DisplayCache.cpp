@@ -0,0 +1,160 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#include "DisplayCache.h"
+#include "Config.h"
+#include "ImageWithInfo.h"
+#include "ImagePyramid.h"
+#include "ImageScaler.h"
+
+#include <QRunnable>
+
+/**
+ * Renders one view of an image and hands it back to the GUI thread.
+ */
+
+class DisplayCacheJob : public QRunnable
+{
+public:
+
+    DisplayCacheJob( DisplayCache * cache, quint64 request, const QImage & source,
+                     const QTransform & transform, qreal dpr )
+        : _cache(cache), _request(request), _source(source), _transform(transform), _dpr(dpr)
+    {
+    }
+
+    void run()
+    {
+        QImage result;
+        if ( _transform.type() <= QTransform::TxScale && _transform.m11() > 0.0 && _transform.m11() < 1.0
+             && _transform.m22() > 0.0 && _transform.m22() < 1.0 )
+        {
+            // no rotation: average the pixels down, same size as transformed()
+            // gives; big renders are split between the cores
+            result = ImageScaler::downscale( _source, int( _transform.m11() * _source.width() + 0.9999 ),
+                                             int( _transform.m22() * _source.height() + 0.9999 ),
+                                             ImageScaler::bestKernel(), g_config.render_threads );
+        } else {
+            result = _source.transformed( _transform, Qt::SmoothTransformation );
+        }
+        result.setDevicePixelRatio( _dpr );
+        _source = QImage();
+        QMetaObject::invokeMethod( _cache, "_finished", Qt::QueuedConnection,
+                                   Q_ARG(quint64, _request), Q_ARG(QImage, result) );
+    }
+
+private:
+
+    DisplayCache * _cache;
+    quint64 _request;
+    QImage _source;
+    QTransform _transform;
+    qreal _dpr;
+};
+
+DisplayCache::DisplayCache( QObject * parent )
+    : QObject( parent )
+{
+    _request = 0;
+    _next_request = 0;
+    _pool.setMaxThreadCount( 1 );
+}
+
+DisplayCache::~DisplayCache( void )
+{
+    // no job may post to a deleted cache
+    _pool.waitForDone();
+}
+
+QImage DisplayCache::get( ImageWithInfo & img, qreal dpr )
+{
+    if ( img.isNull() || img.zoom <= 0.0 )
+        return QImage();
+
+    Key key;
+    key.image = img.image->cacheKey();
+    key.zoom = img.zoom;
+    key.rotation = img.rotation;
+    key.dpr = dpr;
+    if ( key == _key && !_result.isNull() )
+        return _result;
+
+    // the view changed, the old rendering is useless
+    _result = QImage();
+    _key = Key();
+    if ( key == _wanted )
+        return QImage(); // already scheduled
+
+    // start from the pyramid level closest to the final size, it is
+    // cheaper to resample and the quality is the same
+    const QImage * source = img.image;
+    double scale = img.zoom * dpr;
+    if ( img.pyramid != NULL )
+        source = &img.pyramid->level( img.pyramid->levelForZoom( scale ) );
+    QTransform tr;
+    tr.rotate( -img.rotation );
+    tr.scale( scale * img.width() / source->width(), scale * img.height() / source->height() );
+
+    _wanted = key;
+    _wanted_job.source = *source;
+    _wanted_job.transform = tr;
+    if ( _request == 0 )
+        _start();
+    return QImage();
+}
+
+void DisplayCache::clear( void )
+{
+    _result = QImage();
+    _key = _wanted = _running = Key();
+    _wanted_job = Job();
+    _request = 0; // the result of a running job will be ignored
+}
+
+/*******************************************************************************
+ * PRIVATE METHODS
+ *******************************************************************************/
+
+void DisplayCache::_finished( quint64 request, QImage result )
+{
+    if ( request != _request )
+        return;
+    _request = 0;
+
+    if ( _running == _wanted )
+    {
+        _key = _running;
+        _result = result;
+        _wanted_job = Job();
+        emit ready();
+    } else if ( !_wanted_job.source.isNull() ) {
+        // the view changed while rendering
+        _start();
+    }
+}
+
+void DisplayCache::_start( void )
+{
+    _request = ++_next_request;
+    _running = _wanted;
+    _pool.start( new DisplayCacheJob( this, _request, _wanted_job.source,
+                                      _wanted_job.transform, _wanted.dpr ) );
+    _wanted_job = Job();
+}
@@ -0,0 +1,97 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#ifndef DISPLAYCACHE_H
+#define DISPLAYCACHE_H
+
+#include <QObject>
+#include <QImage>
+#include <QThreadPool>
+#include <QTransform>
+
+class ImageWithInfo;
+
+/**
+ * Smoothly resampled copy of the current image, ready to be blitted.
+ *
+ * The rendering depends only on the image, the zoom, the rotation and the
+ * device pixel ratio. It is produced on a worker thread; until it is ready
+ * the viewer draws the image the normal way, and ready() asks for a repaint.
+ */
+
+class DisplayCache : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    DisplayCache( QObject * parent = 0 );
+    ~DisplayCache( void );
+
+    // the cached rendering for the current view of img, or a null image
+    // (the rendering is then scheduled and ready() is emitted later)
+    QImage get( ImageWithInfo & img, qreal dpr );
+
+    // drops the rendering and forgets about pending ones
+    void clear( void );
+
+signals:
+
+    void ready( void );
+
+private slots:
+
+    void _finished( quint64 request, QImage result );
+
+private:
+
+    struct Key
+    {
+        qint64 image = 0; // QImage::cacheKey of the full image
+        double zoom = 0.0;
+        double rotation = 0.0;
+        qreal dpr = 0.0;
+
+        inline bool operator==( const Key & other ) const
+        {
+            return image == other.image && zoom == other.zoom
+                && rotation == other.rotation && dpr == other.dpr;
+        }
+    };
+
+    struct Job
+    {
+        QImage source;
+        QTransform transform;
+    };
+
+    QThreadPool _pool;
+    Key _key;          // key of _result
+    QImage _result;
+    Key _wanted;       // key of the last request
+    Job _wanted_job;
+    quint64 _request;  // id of the job being rendered (0 = none)
+    Key _running;      // key of the job being rendered
+    quint64 _next_request;
+
+    void _start( void );
+};
+
+#endif // DISPLAYCACHE_H
@@ -0,0 +1,319 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#include "ExifReader.h"
+#include <QFile>
+#include <QByteArray>
+#include <string.h>
+
+#define EXIF_MAX_SEGMENTS 64
+
+/**
+ * Bounds-checked access to a TIFF structure in either byte order.
+ */
+
+struct TiffData
+{
+	const uchar * data;
+	qint64 size;
+	bool big_endian;
+
+	bool init( const uchar * d, qint64 s )
+	{
+		data = d;
+		size = s;
+		if ( size < 8 ) return false;
+		if ( data[0] == 'I' && data[1] == 'I' && data[2] == 0x2A && data[3] == 0x00 )
+			big_endian = false;
+		else if ( data[0] == 'M' && data[1] == 'M' && data[2] == 0x00 && data[3] == 0x2A )
+			big_endian = true;
+		else
+			return false;
+		return true;
+	}
+
+	bool u16( qint64 pos, quint32 & v ) const
+	{
+		if ( pos < 0 || pos + 2 > size ) return false;
+		const uchar * p = data + pos;
+		v = big_endian ? ( ( p[0] << 8 ) | p[1] ) : ( ( p[1] << 8 ) | p[0] );
+		return true;
+	}
+
+	bool u32( qint64 pos, quint32 & v ) const
+	{
+		if ( pos < 0 || pos + 4 > size ) return false;
+		const uchar * p = data + pos;
+		if ( big_endian )
+			v = ( (quint32)p[0] << 24 ) | ( (quint32)p[1] << 16 ) | ( (quint32)p[2] << 8 ) | p[3];
+		else
+			v = ( (quint32)p[3] << 24 ) | ( (quint32)p[2] << 16 ) | ( (quint32)p[1] << 8 ) | p[0];
+		return true;
+	}
+
+	// value of a SHORT or LONG entry with count 1
+	bool value( qint64 entry, quint32 & v ) const
+	{
+		quint32 type;
+		if ( !u16( entry + 2, type ) ) return false;
+		if ( type == 3 ) return u16( entry + 8, v );
+		if ( type == 4 ) return u32( entry + 8, v );
+		return false;
+	}
+
+	// string of an ASCII entry (without the terminating zero)
+	bool ascii( qint64 entry, QByteArray & s ) const
+	{
+		quint32 type, count, offset;
+		if ( !u16( entry + 2, type ) || type != 2 || !u32( entry + 4, count ) || count == 0 )
+			return false;
+		if ( count <= 4 )
+			offset = entry + 8;
+		else if ( !u32( entry + 8, offset ) )
+			return false;
+		if ( (qint64)offset + count > size )
+			return false;
+		const char * p = (const char *)data + offset;
+		s = QByteArray( p, qstrnlen( p, count ) );
+		return true;
+	}
+
+	// number of entries of an IFD, 0 if the IFD is not inside the data
+	quint32 entries( quint32 ifd ) const
+	{
+		quint32 n;
+		if ( ifd == 0 || !u16( ifd, n ) ) return 0;
+		if ( ifd + 2 + (qint64)n * 12 > size ) return 0;
+		return n;
+	}
+
+	quint32 nextIfd( quint32 ifd ) const
+	{
+		quint32 next = 0;
+		quint32 n = entries( ifd );
+		if ( n == 0 || !u32( ifd + 2 + (qint64)n * 12, next ) ) return 0;
+		return next;
+	}
+};
+
+// reads one APP1/APP2 segment (mapped into memory when possible) and parses it
+static bool parseSegment( QFile & f, int marker, qint64 offset, qint64 size, ExifInfo & info )
+{
+	QByteArray copy;
+	uchar * map = f.map( offset, size );
+	const uchar * d = map;
+	if ( d == NULL )
+	{
+		if ( !f.seek( offset ) )
+			return false;
+		copy = f.read( size );
+		if ( copy.size() != size )
+			return false;
+		d = (const uchar *)copy.constData();
+	}
+
+	bool ok = false;
+	if ( marker == 0xE1 && size > 6 && memcmp( d, "Exif\0\0", 6 ) == 0 )
+		ok = ExifReader::parseExif( d + 6, size - 6, offset + 6, info );
+	else if ( marker == 0xE2 && size > 4 && memcmp( d, "MPF\0", 4 ) == 0 )
+		ok = ExifReader::parseMpf( d + 4, size - 4, offset + 4, info );
+
+	if ( map != NULL )
+		f.unmap( map );
+	return ok;
+}
+
+bool ExifReader::read( const QString & fullname, ExifInfo & info )
+{
+	QFile f( fullname );
+	if ( !f.open(QIODevice::ReadOnly) )
+		return false;
+
+	uchar hdr[5];
+	if ( f.read( (char*)hdr, 2 ) != 2 || hdr[0] != 0xFF || hdr[1] != 0xD8 )
+		return false;
+
+	// walk the segment headers until the frame header
+	bool found_exif = false;
+	bool found_mpf = false;
+	bool found_frame = false;
+	qint64 pos = 2;
+	for ( int i = 0; i < EXIF_MAX_SEGMENTS; i++ )
+	{
+		if ( f.read( (char*)hdr, 4 ) != 4 || hdr[0] != 0xFF )
+			break;
+		int marker = hdr[1];
+		if ( marker == 0xDA || marker == 0xD9 ) // start of scan, end of image
+			break;
+		qint64 len = ( hdr[2] << 8 ) | hdr[3];
+		if ( len < 2 )
+			break;
+
+		// SOFn (except DHT, JPG and DAC): precision, height, width
+		if ( marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC )
+		{
+			if ( f.read( (char*)hdr, 5 ) == 5 )
+			{
+				info.height = ( hdr[1] << 8 ) | hdr[2];
+				info.width = ( hdr[3] << 8 ) | hdr[4];
+				found_frame = true;
+			}
+			break; // the metadata segments are before the frame
+		}
+
+		if ( ( marker == 0xE1 && !found_exif ) || ( marker == 0xE2 && !found_mpf ) )
+		{
+			bool ok = parseSegment( f, marker, pos + 4, len - 2, info );
+			if ( marker == 0xE1 ) found_exif = ok;
+			else found_mpf = ok;
+		}
+
+		pos += 2 + len;
+		if ( !f.seek( pos ) )
+			break;
+	}
+
+	return found_exif || found_mpf || found_frame;
+}
+
+void ExifReader::orientationTransform( int orientation, qreal * rotation, bool * mirror )
+{
+	qreal r = 0;
+	bool m = false;
+	switch ( orientation )
+	{
+		case 1: m = false; r =   0; break;
+		case 2: m =  true; r =   0; break;
+		case 3: m = false; r = 180; break;
+		case 4: m =  true; r = 180; break;
+		case 5: m =  true; r = -90; break;
+		case 6: m = false; r =  90; break;
+		case 7: m =  true; r =  90; break;
+		case 8: m = false; r = -90; break;
+		default: break;
+	}
+	if ( rotation != NULL ) *rotation = r;
+	if ( mirror != NULL ) *mirror = m;
+}
+
+bool ExifReader::parseExif( const uchar * data, qint64 size, qint64 base, ExifInfo & info )
+{
+	TiffData t;
+	if ( !t.init( data, size ) )
+		return false;
+
+	quint32 ifd0;
+	if ( !t.u32( 4, ifd0 ) )
+		return false;
+
+	// IFD0: orientation, date and pointer to the Exif IFD
+	quint32 n = t.entries( ifd0 );
+	quint32 exif_ifd = 0;
+	QByteArray date;
+	for ( quint32 i = 0; i < n; i++ )
+	{
+		qint64 e = ifd0 + 2 + (qint64)i * 12;
+		quint32 tag, v;
+		t.u16( e, tag );
+		if ( tag == 0x0112 && t.value( e, v ) && v >= 1 && v <= 8 )
+			info.orientation = v;
+		else if ( tag == 0x8769 )
+			t.value( e, exif_ifd );
+		else if ( tag == 0x0132 )
+			t.ascii( e, date );
+	}
+
+	// Exif IFD: capture date and pixel dimensions
+	n = t.entries( exif_ifd );
+	for ( quint32 i = 0; i < n; i++ )
+	{
+		qint64 e = exif_ifd + 2 + (qint64)i * 12;
+		quint32 tag, v;
+		t.u16( e, tag );
+		if ( tag == 0x9003 )
+			t.ascii( e, date );
+		else if ( tag == 0xA002 && t.value( e, v ) && v <= 65535 )
+			info.width = v;
+		else if ( tag == 0xA003 && t.value( e, v ) && v <= 65535 )
+			info.height = v;
+	}
+	if ( !date.isEmpty() )
+		info.capture_time = QDateTime::fromString( QString::fromLatin1(date), "yyyy:MM:dd HH:mm:ss" );
+
+	// IFD1 describes the embedded thumbnail
+	quint32 ifd1 = t.nextIfd( ifd0 );
+	n = t.entries( ifd1 );
+	quint32 offset = 0, length = 0;
+	for ( quint32 i = 0; i < n; i++ )
+	{
+		qint64 e = ifd1 + 2 + (qint64)i * 12;
+		quint32 tag;
+		t.u16( e, tag );
+		if ( tag == 0x0201 ) t.value( e, offset );
+		else if ( tag == 0x0202 ) t.value( e, length );
+	}
+	if ( offset > 0 && length > 0 && (qint64)offset + length <= size )
+	{
+		ExifPreview p;
+		p.offset = base + offset;
+		p.length = length;
+		info.previews.append( p );
+	}
+	return true;
+}
+
+bool ExifReader::parseMpf( const uchar * data, qint64 size, qint64 base, ExifInfo & info )
+{
+	TiffData t;
+	if ( !t.init( data, size ) )
+		return false;
+
+	quint32 ifd0;
+	if ( !t.u32( 4, ifd0 ) )
+		return false;
+
+	// MP Entry: 16 bytes per image (attribute, size, offset, dependencies)
+	quint32 n = t.entries( ifd0 );
+	for ( quint32 i = 0; i < n; i++ )
+	{
+		qint64 e = ifd0 + 2 + (qint64)i * 12;
+		quint32 tag, count, entries_offset;
+		t.u16( e, tag );
+		if ( tag != 0xB002 || !t.u32( e + 4, count ) || !t.u32( e + 8, entries_offset ) )
+			continue;
+		for ( quint32 k = 0; k < count / 16; k++ )
+		{
+			quint32 attribute, img_size, img_offset;
+			qint64 p = entries_offset + (qint64)k * 16;
+			if ( !t.u32( p, attribute ) || !t.u32( p + 4, img_size ) || !t.u32( p + 8, img_offset ) )
+				break;
+			quint32 type = attribute & 0xFFFFFF;
+			// large thumbnails (VGA and full HD classes); offset 0 is the primary image
+			if ( img_offset != 0 && img_size > 0 && ( type == 0x010001 || type == 0x010002 ) )
+			{
+				ExifPreview preview;
+				preview.offset = base + img_offset;
+				preview.length = img_size;
+				info.previews.append( preview );
+			}
+		}
+	}
+	return true;
+}
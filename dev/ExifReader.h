@@ -0,0 +1,72 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#ifndef EXIFREADER_H
+#define EXIFREADER_H
+
+#include <QString>
+#include <QList>
+#include <QDateTime>
+
+/**
+ * Location of a JPEG preview embedded in an image file
+ * (absolute offset and length inside the file).
+ */
+
+struct ExifPreview
+{
+	qint64 offset = 0;
+	qint64 length = 0;
+};
+
+struct ExifInfo
+{
+	int orientation = 1; // EXIF orientation (1-8)
+	int width = 0; // pixel dimensions (from the frame header, or
+	int height = 0; // from the Exif IFD if there is none)
+	QDateTime capture_time; // DateTimeOriginal, or DateTime
+	QList<ExifPreview> previews; // IFD1 thumbnail and MPF (APP2) previews
+};
+
+/**
+ * Reads the metadata segments at the start of a JPEG file in one pass.
+ * Only the segment headers, the frame header and the APP1/APP2 segments
+ * are touched (the segments are memory mapped when possible), never the
+ * compressed image data.
+ */
+
+class ExifReader
+{
+public:
+
+	static bool read( const QString & fullname, ExifInfo & info );
+
+	// rotation (degrees) and mirroring needed to display an orientation
+	static void orientationTransform( int orientation, qreal * rotation, bool * mirror );
+
+	// parse the TIFF structure of an APP1 "Exif" segment;
+	// base is the file offset of the TIFF header
+	static bool parseExif( const uchar * data, qint64 size, qint64 base, ExifInfo & info );
+
+	// parse the TIFF structure of an APP2 "MPF" segment
+	static bool parseMpf( const uchar * data, qint64 size, qint64 base, ExifInfo & info );
+};
+
+#endif // EXIFREADER_H
@@ -24,6 +24,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "Config.h"
 #include "ImageArea.h"
 #include "ScreenSettings.h"
+#include "Trace.h"
+
+// transition durations, in milliseconds
+#define ENLARGE_DURATION 160
+#define REDUCE_DURATION 210
+#define FIT_DURATION 225
+
+// frames without an update request before the fallback timer steps
+#define FRAME_FALLBACK_FRAMES 3
 
 /*******************************************************************************
  * CONSTRUCTOR / DESTRUCTOR
@@ -34,10 +43,8 @@ ImageArea::ImageArea(QWidget *parent)
     , _front_viewer(nullptr)
     , _dir_view(false)
     , _hide_cursor_timer(0)
-    , _enlarge_timer(this)
-    , _reduce_timer(this)
-    , _fit_timer(this)
-    , _enlarge_parameter(0.01)
+    , _frame_requested(false)
+    , _frame_timer(this)
     , _start_zoom(1.0)
     , _start_pos(0,0)
     , _thumb_zoom(0.05)
@@ -62,9 +69,9 @@ ImageArea::ImageArea(QWidget *parent)
     }
     setAcceptDrops(true);
 
-    connect( &_enlarge_timer, SIGNAL(timeout()), this, SLOT(enlargeImage()) );
-    connect( &_reduce_timer, SIGNAL(timeout()),this, SLOT(reduceImage()) );
-    connect( &_fit_timer, SIGNAL(timeout()), this, SLOT(fitImage()));
+    _frame_timer.setTimerType( Qt::PreciseTimer );
+    _frame_timer.setSingleShot( true );
+    connect( &_frame_timer, SIGNAL(timeout()), this, SLOT(onFrame()) );
 
     connect( &_image_viewer, SIGNAL(fitImage()), this, SLOT(onFitImage()));
 }
@@ -141,9 +148,10 @@ void ImageArea::updateSize( int w, int h )
 
 void ImageArea::paintEvent(QPaintEvent *event)
 {
+    TRACE_SCOPE( "ImageArea::paintEvent" );
     QPainter painter(this);
 
-    if( !_enlarge_timer.isActive() && !_reduce_timer.isActive() )
+    if( !_enlarge.isRunning() && !_reduce.isRunning() )
     {
         if ( g_config.smooth_images )
         {
@@ -158,7 +166,7 @@ void ImageArea::paintEvent(QPaintEvent *event)
     double zoom = _image_viewer.getZoom();
     double zoomRatio = zoom/fitZoom;
     if(!_front_viewer && !_dir_view && zoomRatio < 0.70 &&
-       (_enlarge_timer.isActive() || _reduce_timer.isActive() || _image_viewer.isBeingPinchZoomed() )  )
+       (_enlarge.isRunning() || _reduce.isRunning() || _image_viewer.isBeingPinchZoomed() )  )
     {
         double transparency = (zoomRatio-_thumb_zoom/fitZoom)/(0.70-_thumb_zoom/fitZoom);
         QTransform transform;
@@ -204,6 +212,18 @@ bool ImageArea::event( QEvent * event )
     return true;
 }
 
+bool ImageArea::eventFilter( QObject * object, QEvent * event )
+{
+    // the frame asked with requestUpdate(): step before the window paints
+    if ( object == _frame_window && event->type() == QEvent::UpdateRequest
+         && _frame_requested )
+    {
+        _frame_requested = false;
+        onFrame();
+    }
+    return QWidget::eventFilter( object, event );
+}
+
 void ImageArea::onKeyPress( QKeyEvent * event )
 {
     ScreenBase * w = getCurrentViewer();
@@ -239,8 +259,10 @@ void ImageArea::dragEnterEvent( QDragEnterEvent * event )
 
 void ImageArea::onTimer( void )
 {
+    TRACE_SCOPE( "ImageArea::onTimer" );
+    // the image slide is stepped by onFrame()
     ScreenBase * w = getCurrentViewer();
-    if ( w ) w->onTimer();
+    if ( w && w != &_image_viewer ) w->onTimer();
     if ( _hide_cursor_timer > 0 )
     {
         _hide_cursor_timer -= g_config.timer_duration;
@@ -251,17 +273,62 @@ void ImageArea::onTimer( void )
         }
     }
 
+    // a transition started without a startTimer() signal
+    if ( _image_viewer.isChanging() )
+        _startFrames();
+
     _cleanOldViewers();
 }
 
 void ImageArea::onStartTimer( void )
 {
     _timer.start( g_config.timer_duration );
+    if ( _image_viewer.isChanging() )
+        _startFrames();
+}
+
+void ImageArea::onFrame( void )
+{
+    TRACE_SCOPE( "ImageArea::onFrame" );
+
+    // each step computes its state from the elapsed time and asks for a
+    // repaint; Qt merges the requests into one paint event
+    bool animating = false;
+    if ( _enlarge.isRunning() )
+    {
+        enlargeImage();
+        animating = true;
+    }
+    if ( _reduce.isRunning() )
+    {
+        reduceImage();
+        animating = true;
+    }
+    if ( _fit.isRunning() )
+    {
+        fitImage();
+        animating = true;
+    }
+    if ( _image_viewer.isChanging() )
+    {
+        _image_viewer.onTimer();
+        animating = true;
+    }
+
+    if ( animating )
+        _requestFrame();
+    else
+        _frame_timer.stop();
+}
+
+void ImageArea::onUpdateRect( QRect rect )
+{
+    update( rect );
 }
 
 void ImageArea::onChangeMode( void )
 {
-    if( _enlarge_timer.isActive() ) return;
+    if( _enlarge.isRunning() ) return;
 
     if ( _front_viewer )
     {
@@ -280,37 +347,38 @@ void ImageArea::onChangeMode( void )
         _dir_view = false;
         if ( g_config.disable_animations )
         {
-            _enlarge_parameter = 1.0;
+            _enlarge.start( 0 );
             enlargeImage();
         } else {
             _thumb_pos = _dir_viewer.currentItemPosition();
             _image_viewer.setZoom(_thumb_zoom);
             _image_viewer.setView(_thumb_pos);
-            _enlarge_timer.start(20);
+            _enlarge.start( ENLARGE_DURATION, QEasingCurve::OutCubic );
         }
+        _startFrames();
     } else {
         if ( g_config.disable_animations )
         {
-            _enlarge_parameter = 0.0;
+            _reduce.start( 0 );
             reduceImage();
         } else {
-            _enlarge_parameter = 1.0;
             _thumb_pos = _dir_viewer.currentItemPosition();
             _start_pos = _image_viewer.getView();
             _start_zoom = _image_viewer.getZoom();
             _start_angle = _image_viewer.getRotation();
-            _reduce_timer.start(15);
+            _reduce.start( REDUCE_DURATION, QEasingCurve::InOutQuad );
+            _startFrames();
         }
     }
 }
 
 void ImageArea::onFitImage( void )
 {
-    _enlarge_parameter = 0.013;
     _start_pos = _image_viewer.getView();
     _start_zoom = _image_viewer.getZoom();
     _start_angle = _image_viewer.getRotation();
-    _fit_timer.start(15);
+    _fit.start( FIT_DURATION, QEasingCurve::OutCubic );
+    _startFrames();
 }
 
 /*******************************************************************************
@@ -321,6 +389,7 @@ void ImageArea::_connectSignals( ScreenBase * w )
 {
     if ( w == NULL ) return;
     connect( w, SIGNAL(updateSignal()), this, SLOT(update()) );
+    connect( w, SIGNAL(updateRectSignal(QRect)), this, SLOT(onUpdateRect(QRect)) );
     connect( w, SIGNAL(closeOnTouch()), this, SLOT(passCloseOnTouch()) );
     connect( w, SIGNAL(changeFullscreen()), this, SLOT(passChangeFullScreen()) );
     connect( w, SIGNAL(loadFile()), this, SLOT(passLoadFile()) );
@@ -338,38 +407,40 @@ void ImageArea::indexChanged( int index )
 
 void ImageArea::enlargeImage( void )
 {
-    if ( _image_viewer.isReady() )
+    // the transition starts once the image is decoded
+    if ( !_image_viewer.isReady() )
     {
-        _enlarge_parameter = _enlarge_parameter + 0.14;
-        double fitZoom = _image_viewer.computeCurrentFitZoom();
-        _image_viewer.setZoom( fitZoom*_enlarge_parameter+_thumb_zoom*(1.0-_enlarge_parameter) );
-        _image_viewer.setView( _thumb_pos*(1.0-_enlarge_parameter) );
-        if( _enlarge_parameter > 1.0 )
-        {
-            _image_viewer.setView( QPoint(0,0) );
-            _enlarge_parameter = 0.0;
-            _enlarge_timer.stop();
-            _image_viewer.setZoom( fitZoom );
-        }
-        update();
+        _enlarge.restart();
+        return;
+    }
+
+    double p = _enlarge.progress();
+    double fitZoom = _image_viewer.computeCurrentFitZoom();
+    _image_viewer.setZoom( fitZoom*p+_thumb_zoom*(1.0-p) );
+    _image_viewer.setView( _thumb_pos*(1.0-p) );
+    if( _enlarge.isFinished() )
+    {
+        _image_viewer.setView( QPoint(0,0) );
+        _enlarge.stop();
+        _image_viewer.setZoom( fitZoom );
     }
+    update();
 }
 void ImageArea::reduceImage( void )
 {
-    _enlarge_parameter = _enlarge_parameter - 0.07;
-    _image_viewer.setZoom( _start_zoom*_enlarge_parameter + _thumb_zoom*(1.0-_enlarge_parameter) );
-    _image_viewer.setView( _start_pos*_enlarge_parameter + _thumb_pos*(1.0-_enlarge_parameter) );
-    double _enlarge_parameter2 = 1.0 -( _enlarge_parameter-1.0 ) * ( _enlarge_parameter-1.0 );
+    double p = 1.0 - _reduce.progress();
+    _image_viewer.setZoom( _start_zoom*p + _thumb_zoom*(1.0-p) );
+    _image_viewer.setView( _start_pos*p + _thumb_pos*(1.0-p) );
+    double p2 = 1.0 -( p-1.0 ) * ( p-1.0 );
     if ( _start_angle < 180.0 )
     {
-        _image_viewer.setRotation(_start_angle*_enlarge_parameter2 );
+        _image_viewer.setRotation(_start_angle*p2 );
     } else {
-        _image_viewer.setRotation(360.0+(_start_angle-360.0)*_enlarge_parameter2 );
+        _image_viewer.setRotation(360.0+(_start_angle-360.0)*p2 );
     }
-    if ( _enlarge_parameter < 0.01 )
+    if ( _reduce.isFinished() )
     {
-        _enlarge_parameter = 0.01;
-        _reduce_timer.stop();
+        _reduce.stop();
         _image_viewer.resetView();
         _dir_viewer.changeFromOtherViewer( &_image_viewer );
         _dir_view = true;
@@ -379,15 +450,14 @@ void ImageArea::reduceImage( void )
 
 void ImageArea::fitImage( void )
 {
-    _enlarge_parameter = _enlarge_parameter + 0.07;
+    double p = _fit.progress();
     double fitZoom = _image_viewer.computeCurrentFitZoom();
-    _image_viewer.setZoom( fitZoom*_enlarge_parameter + _start_zoom*(1.0-_enlarge_parameter) );
-    _image_viewer.setView( _start_pos*(1.0-_enlarge_parameter) );
+    _image_viewer.setZoom( fitZoom*p + _start_zoom*(1.0-p) );
+    _image_viewer.setView( _start_pos*(1.0-p) );
 
-    if ( _enlarge_parameter > 1.0 )
+    if ( _fit.isFinished() )
     {
-        _enlarge_parameter = 1.0;
-        _fit_timer.stop();
+        _fit.stop();
         _image_viewer.setZoom( fitZoom );
         _image_viewer.setView( QPoint(0,0) );
     }
@@ -403,3 +473,35 @@ void ImageArea::_cleanOldViewers( void )
         delete vptr;
     }
 }
+
+void ImageArea::_startFrames( void )
+{
+    // while animating, the fallback timer is always armed
+    if ( !_frame_timer.isActive() )
+        _requestFrame();
+}
+
+void ImageArea::_requestFrame( void )
+{
+    // the window sends an update request when it can show the next frame
+    // (at vsync where the platform supports it)
+    QWindow * handle = window()->windowHandle();
+    if ( handle != _frame_window )
+    {
+        if ( _frame_window )
+            _frame_window->removeEventFilter( this );
+        _frame_window = handle;
+        _frame_requested = false;
+        if ( handle )
+            handle->installEventFilter( this );
+    }
+    if ( handle && !_frame_requested )
+    {
+        _frame_requested = true;
+        handle->requestUpdate();
+    }
+
+    // a hidden window or a platform without update requests: step anyway
+    _frame_timer.start( handle ? FRAME_FALLBACK_FRAMES * Animation::frameInterval()
+                               : Animation::frameInterval() );
+}
@@ -24,11 +24,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QColor>
 #include <QImage>
 #include <QPoint>
+#include <QPointer>
 #include <QWidget>
 #include <QTimer>
 #include <QDateTime>
 #include <QTouchEvent>
+#include <QWindow>
 
+#include "Animation.h"
 #include "ScreenViewer.h"
 #include "ScreenDirectory.h"
 
@@ -46,10 +49,12 @@ private:
     QTimer _timer;
     int _hide_cursor_timer;
 
-    QTimer _enlarge_timer;
-    QTimer _reduce_timer;
-    QTimer _fit_timer;
-    double _enlarge_parameter;
+    QPointer<QWindow> _frame_window; // window whose update requests pace the frames
+    bool _frame_requested;
+    QTimer _frame_timer; // fallback when no update request arrives
+    Animation _enlarge;
+    Animation _reduce;
+    Animation _fit;
     double _start_zoom;
     double _start_angle;
     QPoint _start_pos;
@@ -80,6 +85,7 @@ protected:
     void paintEvent(QPaintEvent *event);
     void resizeEvent(QResizeEvent *event);
     bool event(QEvent *event);
+    bool eventFilter(QObject *object, QEvent *event);
     void dropEvent( QDropEvent * de );
     void dragMoveEvent( QDragMoveEvent * de );
     void dragEnterEvent( QDragEnterEvent * event );
@@ -93,6 +99,8 @@ protected slots:
 
     void onTimer( void );
     void onStartTimer( void );
+    void onFrame( void );
+    void onUpdateRect( QRect rect );
     void onChangeMode( void );
     void indexChanged( int );
     void enlargeImage( void );
@@ -115,6 +123,8 @@ private:
 
     void _connectSignals( ScreenBase * w );
     void _cleanOldViewers( void );
+    void _startFrames( void );
+    void _requestFrame( void );
 
 public:
 
@@ -22,15 +22,39 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define IMAGELOADITEM_H
 
 #include <QImage>
+#include <QMetaType>
+#include "ImagePyramid.h"
 
 struct ImageLoadItem
 {
+    QString dir; // folder of the file, set when queued (not g_config.current_dir)
     QString name;
-    QImage ** destination = nullptr;
+    bool build_pyramid = false; // also build a tiled pyramid of the image
+    bool progressive = false; // send a quick low resolution image first
     int w = 0;
     int h = 0;
     bool force_fit_in_size = false;
+    bool thumbnail = false; // may be read from / written to the thumbnail cache
+    int preview_w = 0; // an embedded preview at least this big can replace
+    int preview_h = 0; // the full decode (0 = always decode the image)
     int priority = 0;
+    int index = -1; // identifies the item (negative for wake-up markers)
+    int generation = 0; // set by ImageLoadThread::addLoadImage()
+    qint64 queued_at = 0; // Metrics::now() when added (set by addLoadImage())
 };
 
+struct ImageLoadResult
+{
+    int index = -1;
+    int generation = 0;
+    QString name; // the index may be stale if the file list grew meanwhile
+    QImage image; // null if the image could not be loaded
+    ImagePyramid pyramid; // only if the item asked for it
+    bool preview = false; // quick low resolution image of a progressive item
+    QSize full_size; // size the full image will have (preview results)
+    qint64 load_time = 0; // microseconds spent in the worker
+};
+
+Q_DECLARE_METATYPE(ImageLoadResult)
+
 #endif // IMAGELOADITEM_H
@@ -19,90 +19,226 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 *******************************************************************************/
 
 #include "ImageLoadQueue.h"
+#include "Trace.h"
 
-// synchronized against all other methods
-ImageLoadItem ImageLoadQueue::pop ( void )
+ImageLoadQueue::ImageLoadQueue( void )
 {
-	ImageLoadItem x;
-	_sem.acquire();
-	_mutex.lock();
-	x = QQueue<ImageLoadItem>::front();
-	QQueue<ImageLoadItem>::pop_front();
-	_mutex.unlock();
-
-	return x;
+	_sequence = 0;
 }
 
 // synchronized against all other methods
 ImageLoadItem ImageLoadQueue::popWithPriority ( void )
 {
-	ImageLoadItem x;
 	_sem.acquire();
+	TRACE_SCOPE( "queue.pop" );
 	_mutex.lock();
-
-	QQueue<ImageLoadItem>::Iterator it;
-	QQueue<ImageLoadItem>::Iterator it_max;
-	int max_prio = -1;
-	for ( it = this->begin(); it != this->end(); it++ )
-	{
-		if ( it->priority > max_prio )
-		{
-			max_prio =  it->priority;
-			it_max = it;
-		}
-	}
-
-	x = *it_max;
-	this->erase( it_max );
+	Node x = _takeTop();
 	_mutex.unlock();
 
-	return x;
+	return x.item;
 }
 
-// synchronized only against pop
-void ImageLoadQueue::push ( const ImageLoadItem &x )
+// synchronized against all other methods
+// if the index is already queued, the queued item is replaced
+// returns true if a new item was added to the queue
+bool ImageLoadQueue::push ( const ImageLoadItem &x )
 {
+	TRACE_SCOPE( "queue.push" );
+	bool added = false;
 	_mutex.lock();
-	QQueue<ImageLoadItem>::push_back(x);
-	_sem.release();
+	QHash<int, int>::const_iterator it = _slots.constFind( x.index );
+	if ( x.index >= 0 && it != _slots.constEnd() )
+	{
+		int i = it.value();
+		int old_priority = _heap[i].item.priority;
+		_heap[i].item = x;
+		_heap[i].item.priority = old_priority;
+		_setPriority( i, x.priority );
+	} else {
+		Node n;
+		n.item = x;
+		n.sequence = _sequence++;
+		n.boosted = false;
+		_heap.append( n );
+		int i = _heap.size() - 1;
+		if ( x.index >= 0 )
+			_slots.insert( x.index, i );
+		_siftUp( i );
+		_sem.release();
+		added = true;
+	}
+	if ( x.priority != 0 && x.index >= 0 )
+		_markBoosted( _slots.value( x.index ) );
 	_mutex.unlock();
+	return added;
 }
 
-// synchronized only against pop
+// synchronized against all other methods
 QList<ImageLoadItem> ImageLoadQueue::clear( void )
 {
 	QList<ImageLoadItem> cleared_items = QList<ImageLoadItem>();
+	_mutex.lock();
+	// removing elements from the end of the array keeps the heap valid
 	while ( _sem.tryAcquire() )
 	{
-		ImageLoadItem x;
-		_mutex.lock();
-		x = QQueue<ImageLoadItem>::front();
-		QQueue<ImageLoadItem>::pop_front();
-		_mutex.unlock();
-		cleared_items.append( x );
+		Node x = _heap.takeLast();
+		if ( x.item.index >= 0 )
+			_slots.remove( x.item.index );
+		cleared_items.append( x.item );
 	}
+	if ( _heap.isEmpty() )
+		_boosted.clear();
+	_mutex.unlock();
 	return cleared_items;
 }
 
 void ImageLoadQueue::clearPriorities( void )
 {
 	_mutex.lock();
-	QQueue<ImageLoadItem>::Iterator it;
-	for ( it = this->begin(); it != this->end(); it++ )
+	_clearPriorities();
+	_mutex.unlock();
+}
+
+void ImageLoadQueue::updatePriority( int index, int priority )
+{
+	_mutex.lock();
+	QHash<int, int>::const_iterator it = _slots.constFind( index );
+	if ( it != _slots.constEnd() )
 	{
-		it->priority = 0;
+		_setPriority( it.value(), priority );
+		if ( priority != 0 )
+			_markBoosted( _slots.value( index ) );
 	}
 	_mutex.unlock();
 }
 
-void ImageLoadQueue::updatePriority( QImage ** dest, int priority )
+// resets all priorities to 0, then gives the listed items
+// decreasing priorities starting with "priority"
+void ImageLoadQueue::reprioritize( const QVector<int> & indexes, int priority )
 {
 	_mutex.lock();
-	QQueue<ImageLoadItem>::Iterator it;
-	for ( it = this->begin(); it != this->end(); it++ )
+	_clearPriorities();
+	for ( int k = 0; k < indexes.size(); k++, priority-- )
 	{
-		if ( it->destination == dest )
-			it->priority = priority;
+		QHash<int, int>::const_iterator it = _slots.constFind( indexes[k] );
+		if ( it == _slots.constEnd() )
+			continue;
+		_setPriority( it.value(), priority );
+		if ( priority != 0 )
+			_markBoosted( _slots.value( indexes[k] ) );
 	}
 	_mutex.unlock();
 }
+
+int ImageLoadQueue::count( void )
+{
+	_mutex.lock();
+	int n = _heap.size();
+	_mutex.unlock();
+	return n;
+}
+
+/*******************************************************************************
+* PRIVATE METHODS (caller holds the mutex)
+*******************************************************************************/
+
+void ImageLoadQueue::_swap( int i, int j )
+{
+	Node x = _heap[i];
+	_heap[i] = _heap[j];
+	_heap[j] = x;
+	if ( _heap[i].item.index >= 0 )
+		_slots[ _heap[i].item.index ] = i;
+	if ( _heap[j].item.index >= 0 )
+		_slots[ _heap[j].item.index ] = j;
+}
+
+void ImageLoadQueue::_siftUp( int i )
+{
+	while ( i > 0 )
+	{
+		int parent = ( i - 1 ) / 2;
+		if ( !_before( _heap[i], _heap[parent] ) )
+			break;
+		_swap( i, parent );
+		i = parent;
+	}
+}
+
+void ImageLoadQueue::_siftDown( int i )
+{
+	int n = _heap.size();
+	while ( true )
+	{
+		int best = i;
+		int l = 2 * i + 1;
+		int r = l + 1;
+		if ( l < n && _before( _heap[l], _heap[best] ) ) best = l;
+		if ( r < n && _before( _heap[r], _heap[best] ) ) best = r;
+		if ( best == i )
+			break;
+		_swap( i, best );
+		i = best;
+	}
+}
+
+void ImageLoadQueue::_setPriority( int i, int priority )
+{
+	int old_priority = _heap[i].item.priority;
+	_heap[i].item.priority = priority;
+	if ( priority > old_priority )
+		_siftUp( i );
+	else if ( priority < old_priority )
+		_siftDown( i );
+}
+
+// lists the item once, however often its priority is raised
+void ImageLoadQueue::_markBoosted( int i )
+{
+	if ( _heap[i].boosted )
+		return;
+	_heap[i].boosted = true;
+	_boosted.append( _heap[i].item.index );
+}
+
+ImageLoadQueue::Node ImageLoadQueue::_takeTop( void )
+{
+	Node top = _heap.first();
+	if ( top.item.index >= 0 )
+		_slots.remove( top.item.index );
+
+	Node last = _heap.takeLast();
+	if ( !_heap.isEmpty() )
+	{
+		_heap[0] = last;
+		if ( last.item.index >= 0 )
+			_slots[ last.item.index ] = 0;
+		_siftDown( 0 );
+	}
+	return top;
+}
+
+void ImageLoadQueue::_clearPriorities( void )
+{
+	if ( _boosted.size() * 4 > _heap.size() )
+	{
+		// most of the queue is affected, cheaper to rebuild the heap in O(n)
+		for ( int i = 0; i < _heap.size(); i++ )
+		{
+			_heap[i].item.priority = 0;
+			_heap[i].boosted = false;
+		}
+		for ( int i = _heap.size() / 2 - 1; i >= 0; i-- )
+			_siftDown( i );
+	} else {
+		for ( int k = 0; k < _boosted.size(); k++ )
+		{
+			QHash<int, int>::const_iterator it = _slots.constFind( _boosted[k] );
+			if ( it == _slots.constEnd() )
+				continue;
+			_heap[it.value()].boosted = false;
+			_setPriority( it.value(), 0 );
+		}
+	}
+	_boosted.clear();
+}
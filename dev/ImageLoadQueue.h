@@ -23,25 +23,70 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "ImageLoadItem.h"
 
-#include <QQueue>
+#include <QVector>
+#include <QHash>
+#include <QList>
 #include <QSemaphore>
 #include <QMutex>
 
-class ImageLoadQueue : public QQueue<ImageLoadItem>
+/**
+ * Indexed priority queue of images waiting to be loaded.
+ *
+ * Items live in a binary max-heap ordered by priority (FIFO among equal
+ * priorities), and a hash maps every item index to its heap slot, so push,
+ * pop and reprioritizing a single item are all O(log n). Items with a
+ * negative index (wake-up markers) are not indexed.
+ */
+
+class ImageLoadQueue
 {
 private:
 
+	struct Node
+	{
+		ImageLoadItem item;
+		quint64 sequence;
+		bool boosted; // listed in _boosted
+	};
+
+	QVector<Node> _heap;
+	QHash<int, int> _slots; // item index -> position in _heap
+	QList<int> _boosted; // items that may have a non-zero priority
+	quint64 _sequence;
+
 	QSemaphore _sem;
 	QMutex _mutex;
 
 public:
 
-	ImageLoadItem pop ( void );
+	ImageLoadQueue( void );
+
+public:
+
 	ImageLoadItem popWithPriority ( void );
-	void push ( const ImageLoadItem &x );
+	bool push ( const ImageLoadItem &x );
 	QList<ImageLoadItem> clear( void );
 	void clearPriorities( void );
-	void updatePriority( QImage ** dest, int priority );
+	void updatePriority( int index, int priority );
+	void reprioritize( const QVector<int> & indexes, int priority );
+	int count( void );
+
+private:
+
+	inline bool _before( const Node & a, const Node & b ) const
+	{
+		if ( a.item.priority != b.item.priority )
+			return a.item.priority > b.item.priority;
+		return a.sequence < b.sequence;
+	}
+
+	void _swap( int i, int j );
+	void _siftUp( int i );
+	void _siftDown( int i );
+	void _setPriority( int i, int priority );
+	void _markBoosted( int i );
+	Node _takeTop( void );
+	void _clearPriorities( void );
 };
 
 #endif // IMAGELOADQUEUE_H
@@ -20,185 +20,394 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "ImageLoadThread.h"
 #include "Config.h"
+#include "ThumbnailCache.h"
+#include "ExifReader.h"
+#include "ImagePyramid.h"
+#include "ImageOrientation.h"
+#include "ImageScaler.h"
+#include "Metrics.h"
+#include "Trace.h"
 #include <QFile>
 #include <QDir>
+#include <QBuffer>
 #include <QImageReader>
+#include <QElapsedTimer>
 #include <math.h>
+#include <algorithm>
 
-void ImageLoadThread::run()
+#define INTERCHAGE_WH(w,h) { int x = w; w = h; h = x; }
+
+void ImageLoadWorker::run()
+{
+	_owner->_work();
+}
+
+ImageLoadThread::~ImageLoadThread( void )
+{
+	for ( int i = 0; i < _workers.size(); i++ )
+		delete _workers[i];
+}
+
+void ImageLoadThread::start( int number_of_workers )
+{
+	if ( number_of_workers <= 0 )
+		number_of_workers = g_config.load_threads;
+	if ( number_of_workers <= 0 )
+		number_of_workers = QThread::idealThreadCount();
+	if ( number_of_workers <= 0 )
+		number_of_workers = 1;
+
+	for ( int i = 0; i < number_of_workers; i++ )
+	{
+		ImageLoadWorker * worker = new ImageLoadWorker( this );
+		_workers.append( worker );
+		worker->start();
+	}
+}
+
+void ImageLoadThread::wait( void )
+{
+	for ( int i = 0; i < _workers.size(); i++ )
+		_workers[i]->wait();
+}
+
+void ImageLoadThread::_work()
 {
 	while ( !_finished )
 	{
 		ImageLoadItem ili = _in.popWithPriority();
 		if ( _finished ) break;
+		if ( ili.index < 0 ) continue;
+		TRACE_SCOPE( "load" );
+		Metrics::record( Metrics::QUEUE_WAIT_US, Metrics::now() - ili.queued_at );
+
+		// cancelled while waiting in the queue
+		if ( ili.generation != generation() )
+		{
+			_itemDone();
+			continue;
+		}
+
+		QElapsedTimer load_timer;
+		load_timer.start();
+		QString fullname = ili.dir + QDir::separator() + ili.name;
+		bool use_cache = ili.thumbnail && g_config.thumbnail_cache;
+
+		// files that failed to decode are not tried again until they change
+		MetadataEntry meta;
+		bool indexed = g_config.metadata_index && MetadataIndex::lookup( fullname, meta );
+
+		// progressive items: a quick low resolution image first (from
+		// the thumbnail cache, an embedded preview or a scaled decode)
+		bool probed = indexed;
+		if ( ili.progressive && !( indexed && meta.failed ) )
+		{
+			ImageLoadItem quick = ili;
+			quick.w = qMax( ili.w / 4, 1 );
+			quick.h = qMax( ili.h / 4, 1 );
+			quick.force_fit_in_size = true;
+			quick.preview_w = quick.w / 2;
+			quick.preview_h = quick.h / 2;
+			quick.progressive = false;
+
+			QImage * small = NULL;
+			if ( g_config.thumbnail_cache )
+				small = ThumbnailCache::load( fullname, quick.w, quick.h );
+			if ( small == NULL )
+			{
+				// the metadata probed here is reused by the full decode
+				small = _loadImage( quick, meta, probed );
+				probed = true;
+			}
+			if ( small != NULL && !small->isNull() && ili.generation == generation() )
+			{
+				ImageLoadResult preview;
+				preview.index = ili.index;
+				preview.generation = ili.generation;
+				preview.name = ili.name;
+				preview.image = *small;
+				preview.preview = true;
+				preview.load_time = load_timer.nsecsElapsed() / 1000;
+				preview.full_size = QSize( meta.width, meta.height );
+				// the size is stored before the EXIF rotation the full image gets
+				if ( g_config.rotate_by_exif && ImageOrientation::swapsAxes( meta.orientation ) )
+					preview.full_size.transpose();
+				emit imageLoaded( preview );
+			}
+			delete small;
+		}
+
+		QImage * img = NULL;
+		if ( use_cache && !( indexed && meta.failed ) )
+		{
+			TRACE_SCOPE( "thumbnail cache" );
+			qint64 t0 = Metrics::now();
+			img = ThumbnailCache::load( fullname, ili.w, ili.h );
+			Metrics::record( Metrics::THUMBNAIL_CACHE_US, Metrics::now() - t0 );
+		}
+		bool from_cache = ( img != NULL );
+		if ( from_cache )
+			Metrics::add( Metrics::THUMBNAIL_CACHE_HITS );
+		bool from_preview = false;
+		if ( img == NULL && !( indexed && meta.failed ) )
+		{
+			img = _loadImage( ili, meta, probed, &from_preview );
+			if ( !indexed && g_config.metadata_index )
+			{
+				meta.failed = ( img == NULL || img->isNull() );
+				MetadataIndex::update( fullname, meta );
+			}
+		}
+
+		ImageLoadResult result;
+		result.index = ili.index;
+		result.generation = ili.generation;
+		result.name = ili.name;
+		if ( img != NULL )
+		{
+			result.image = *img;
+			delete img;
+		}
+
+		// (small embedded previews are not good enough for the cache)
+		bool save_thumb = use_cache && !from_cache && !result.image.isNull()
+			&& ( !from_preview || qMax( result.image.width(), result.image.height() ) >= qMax( ili.w, ili.h ) );
 
-		if ( ili.destination != NULL )
+		// cancelled while loading: the result is dropped here
+		bool current = ( ili.generation == generation() );
+		if ( current && ili.build_pyramid && !result.image.isNull() )
 		{
-			QImage * img = _loadImage( ili.name, ili.w, ili.h, ili.force_fit_in_size );
-			*ili.destination = img;
+			TRACE_SCOPE( "pyramid" );
+			qint64 t0 = Metrics::now();
+			result.pyramid = ImagePyramid( result.image );
+			Metrics::record( Metrics::PYRAMID_US, Metrics::now() - t0 );
 		}
+		result.load_time = load_timer.nsecsElapsed() / 1000;
+		Metrics::record( Metrics::TOTAL_US, result.load_time );
+		Metrics::add( result.image.isNull() ? Metrics::LOAD_FAILURES : Metrics::IMAGES_LOADED );
+		if ( !current )
+			Metrics::add( Metrics::STALE_RESULTS );
 
-		_load_mutex.lock();
-		_load = _in.count();
-		_load_mutex.unlock();
+		_itemDone();
+		if ( current )
+			emit imageLoaded( result );
+
+		// write the cache entry after the image is available
+		if ( save_thumb )
+			ThumbnailCache::save( fullname, result.image, qMax( ili.w, ili.h ) );
 	}
 }
 
-QImage * ImageLoadThread::_loadImage( QString name, int area_width, int area_height, bool force_size )
+void ImageLoadThread::_itemDone( void )
 {
-	QString fullname = g_config.current_dir + QDir::separator() + name;
+	_load_mutex.lock();
+	_load--;
+	if ( _load == 0 )
+		_idle.wakeAll();
+	_load_mutex.unlock();
+}
+
+QImage * ImageLoadThread::_loadImage( const ImageLoadItem & ili, MetadataEntry & meta,
+	bool indexed, bool * from_preview )
+{
+	QString fullname = ili.dir + QDir::separator() + ili.name;
+	int area_width = ili.w;
+	int area_height = ili.h;
+	bool force_size = ili.force_fit_in_size;
 	QImage * img = NULL;
 
-	// get exif rotation if needed
-	qreal rotation = 0;
-	bool mirror = false;
-	if ( g_config.rotate_by_exif )
+	bool want_preview = force_size && ili.preview_w > 0 && ili.preview_h > 0
+		&& g_config.embedded_previews;
+
+	// read the exif metadata (only for jpg files); a file that is not
+	// indexed yet is always read, its entry is completed here
+	ExifInfo exif;
+	bool is_jpeg = fullname.endsWith(".jpg", Qt::CaseInsensitive)
+		|| fullname.endsWith(".jpeg", Qt::CaseInsensitive);
+	if ( is_jpeg && ( !indexed || want_preview ) )
+	{
+		TRACE_SCOPE( "exif" );
+		qint64 t0 = Metrics::now();
+		ExifReader::read( fullname, exif );
+		Metrics::record( Metrics::EXIF_US, Metrics::now() - t0 );
+		if ( !indexed )
+		{
+			meta.width = exif.width;
+			meta.height = exif.height;
+			meta.orientation = exif.orientation;
+			meta.capture_time = exif.capture_time;
+		}
+	} else if ( indexed ) {
+		exif.orientation = meta.orientation;
+	}
+
+	// get exif orientation if needed
+	int orientation = g_config.rotate_by_exif ? exif.orientation : 1;
+	bool swap_wh = ImageOrientation::swapsAxes( orientation );
+
+	// a preview embedded in the file is much faster to decode
+	if ( want_preview && !exif.previews.isEmpty() )
 	{
-		_getExifRotation( fullname, &rotation, &mirror );
+		TRACE_SCOPE( "embedded preview" );
+		qint64 t0 = Metrics::now();
+		img = _loadEmbeddedPreview( fullname, exif, ili, swap_wh );
+		Metrics::record( Metrics::PREVIEW_US, Metrics::now() - t0 );
+		if ( img != NULL )
+			Metrics::add( Metrics::EMBEDDED_PREVIEWS );
+		if ( from_preview != NULL )
+			*from_preview = ( img != NULL );
 	}
 
-	if ( force_size )
+	if ( img == NULL && force_size )
 	{
 		//printf("Loading %s\n", fullname.toUtf8().data() );
 
 		// create image reader
+		TRACE_SCOPE( "decode" );
+		qint64 t0 = Metrics::now();
 		QImageReader * reader = new QImageReader( fullname );
-		QSize size = reader->size();
+		QSize size = meta.width > 0 && meta.height > 0 ? QSize( meta.width, meta.height ) : reader->size();
+		if ( !indexed )
+		{
+			meta.width = size.width();
+			meta.height = size.height();
+		}
+		QSize full = size;
 		int w = size.width();
 		int h = size.height();
 
-		#define INTERCHAGE_WH(w,h) { int x = w; w = h; h = x; }
-
 		// compute the new size
-		if ( (int)rotation % 180 != 0 )
+		if ( swap_wh )
 			INTERCHAGE_WH(w,h);
 		ImageLoadThread::fitImage(w,h, area_width, area_height, true );
-		if ( (int)rotation % 180 != 0 )
+		if ( swap_wh )
 			INTERCHAGE_WH(w,h);
 		size.setWidth(w);
 		size.setHeight(h);
 		//printf("%d,%d\n", w,h);
 
 		// actually load the image
-		img = new QImage(size, reader->imageFormat());
-		reader->setScaledSize( size );
-		if ( !reader->read(img) )
+		Metrics::record( Metrics::OPEN_US, Metrics::now() - t0 );
+		t0 = Metrics::now();
+		img = new QImage();
+		bool ok = _readScaled( *reader, full, size, img );
+		Metrics::record( Metrics::DECODE_US, Metrics::now() - t0 );
+		delete reader;
+		if ( !ok )
 		{
-			delete reader;
 			delete img;
 			return NULL;
 		}
-		delete reader;
-	} else {
+	} else if ( img == NULL ) {
 			(void)area_width;
 			(void)area_height;
+			TRACE_SCOPE( "decode" );
+			qint64 t0 = Metrics::now();
 			img = new QImage( fullname );
+			Metrics::record( Metrics::DECODE_US, Metrics::now() - t0 );
+			if ( !indexed )
+			{
+				meta.width = img->width();
+				meta.height = img->height();
+			}
 	}
 
-	// rotate the image
-	QImage * img2 = img;
-	if ( rotation != 0.0 )
+	// rotate the image (moves pixels, no resampling)
+	if ( orientation > 1 )
 	{
-		QTransform tr;
-		if ( mirror )
-			tr.scale(-1.0, 1.0);
-		tr.rotate(rotation);
-		img2 = new QImage();
-		*img2 = img->transformed( tr, g_config.smooth_images ? Qt::SmoothTransformation : Qt::FastTransformation );
-		delete img;
+		TRACE_SCOPE( "rotate" );
+		qint64 t0 = Metrics::now();
+		ImageOrientation::apply( *img, orientation );
+		Metrics::record( Metrics::ROTATE_US, Metrics::now() - t0 );
 	}
 
-	return img2;
+	return img;
 }
 
-qreal ImageLoadThread::_getExifRotation( QString fullname, qreal * out_rotation, bool * out_mirror )
+QImage * ImageLoadThread::_loadEmbeddedPreview( QString fullname, const ExifInfo & info,
+	const ImageLoadItem & ili, bool swap_wh )
 {
-	// verification
-	if ( out_mirror == NULL || out_rotation == NULL )
-		return 0.0;
+	QFile f( fullname );
+	if ( !f.open(QIODevice::ReadOnly) )
+		return NULL;
 
-	// only check exif for jpg files
-	if ( !fullname.endsWith(".jpg", Qt::CaseInsensitive) && !fullname.endsWith(".jpeg", Qt::CaseInsensitive) )
-		return 0.0;
+	// try the smallest preview first, it is the fastest to decode
+	QList<ExifPreview> previews = info.previews;
+	std::sort( previews.begin(), previews.end(),
+		[]( const ExifPreview & a, const ExifPreview & b ) { return a.length < b.length; } );
 
-	// try to load exif orientation
-	QFile f( fullname );
-	quint16 orientation = 1;
-	if ( f.open(QIODevice::ReadOnly))
+	for ( int i = 0; i < previews.size(); i++ )
 	{
-		// printf("File opened %s\n", fullname.toUtf8().data());
-		// find exif start marker
-
-		unsigned short w;
-		bool in_exif = false;
-		quint16 type = 0;
-		quint32 len = 0;
-		quint8 last_byte, current_byte;
-		bool full_word = false;
-		while ( f.read((char*)&current_byte, sizeof(current_byte)) )
+		if ( previews[i].length > 16 * 1024 * 1024 || !f.seek( previews[i].offset ) )
+			continue;
+		QByteArray data = f.read( previews[i].length );
+		QBuffer buffer( &data );
+		buffer.open( QIODevice::ReadOnly );
+		QImageReader reader( &buffer, "jpeg" );
+		QSize size = reader.size();
+		if ( !size.isValid() )
+			continue;
+
+		// previews are not rotated
+		int w = size.width();
+		int h = size.height();
+		if ( swap_wh )
+			INTERCHAGE_WH(w,h);
+
+		// the result must be as big as it is shown: fitted in the area,
+		// or filling the grid cell when the thumbnails are cropped
+		int shown_w = w;
+		int shown_h = h;
+		if ( ili.thumbnail && g_config.thumbnails_crop )
 		{
-			if ( !full_word )
-			{
-				last_byte = current_byte;
-				full_word = true;
-				continue;
-			}
-			w = ( current_byte << 8 ) | last_byte;
-			if ( in_exif )
-			{
-				if ( current_byte == 0xFF )
-				{
-					in_exif = false;
-					full_word = false;
-				} else if ( w == 0x0112 ) {
-					// HACK
-					f.read((char*)&type, sizeof(type)) > 0
-						&& f.read((char*)&len, sizeof(len)) > 0
-						&& f.read((char*)&orientation, sizeof(orientation)) > 0;
-					break;
-				} else if ( w == 0x1201 ) {
-					f.read((char*)&type, sizeof(type)) > 0
-						&& f.read((char*)&len, sizeof(len)) > 0
-						&& f.read((char*)&orientation, sizeof(orientation)) > 0;
-					orientation = ( ( orientation >> 8 ) & 0xFF ) | ( ( orientation << 8 ) & 0xFF00 );
-					break;
-				}
-			} else {
-				if ( w == 0xE1FF || w == 0xFFE1 )
-				{
-					in_exif = true;
-					full_word = false;
-				}
-			}
-			last_byte = current_byte;
+			double ratio = qMax( (double)ili.preview_w / w, (double)ili.preview_h / h );
+			shown_w = (int)( w * ratio );
+			shown_h = (int)( h * ratio );
+		} else {
+			ImageLoadThread::fitImage( shown_w,shown_h, ili.preview_w, ili.preview_h, false );
 		}
+		ImageLoadThread::fitImage( w,h, ili.w, ili.h, true );
+		if ( w < shown_w || h < shown_h )
+			continue;
 
-		f.close();
+		if ( swap_wh )
+			INTERCHAGE_WH(w,h);
+		QImage * img = new QImage();
+		if ( _readScaled( reader, size, QSize(w,h), img ) )
+			return img;
+		delete img;
+	}
+
+	return NULL;
+}
+
+bool ImageLoadThread::_readScaled( QImageReader & reader, QSize full, QSize size, QImage * img )
+{
+	// JPEG decoders can drop DCT coefficients to decode at 1/2, 1/4 or 1/8
+	// of the size for free: go down to the smallest of those that still
+	// covers the target, then average the pixels down to it
+	QSize decode = full;
+	if ( reader.format() == "jpeg" && full.isValid() )
+	{
+		for ( int d = 2; d <= 8; d *= 2 )
+		{
+			QSize s( ( full.width() + d - 1 ) / d, ( full.height() + d - 1 ) / d );
+			if ( s.width() < size.width() || s.height() < size.height() )
+				break;
+			decode = s;
+		}
 	}
+	if ( decode != full )
+		reader.setScaledSize( decode );
 
-	qreal rotation = 0;
-	bool mirror = false;
-	switch ( orientation )
+	if ( !reader.read( img ) )
+		return false;
+	if ( img->size() != size )
 	{
-		case 1: mirror = false; rotation =   0; break;
-		case 2: mirror =  true; rotation =   0; break;
-		case 3: mirror = false; rotation = 180; break;
-		case 4: mirror =  true; rotation = 180; break;
-		case 5: mirror =  true; rotation = -90; break;
-		case 6: mirror = false; rotation =  90; break;
-		case 7: mirror =  true; rotation =  90; break;
-		case 8: mirror = false; rotation = -90; break;
-		default: break;
+		TRACE_SCOPE( "downscale" );
+		*img = ImageScaler::downscale( *img, size.width(), size.height() );
 	}
-	
-	/*
-	printf("Rotation %u-> rotation=%d mirror=%s\n",
-		(unsigned int)orientation, (int)rotation, (mirror?"true":"false"));
-	*/
-
-	*out_rotation = rotation;
-	*out_mirror = mirror;
-	return rotation;
+	return !img->isNull();
 }
 
 void ImageLoadThread::fitImage( int & w, int & h, int fitw, int fith, bool shrink_only )
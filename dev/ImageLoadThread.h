@@ -22,39 +22,92 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define __IMAGE_LOAD_THREAD_H__
 
 #include <QThread>
+#include <QList>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
 #include "ImageLoadItem.h"
 #include "ImageLoadQueue.h"
+#include "ExifReader.h"
+#include "MetadataIndex.h"
+#include "Metrics.h"
 #include <QImage>
 
+class QImageReader;
 
-class ImageLoadThread : public QThread
+class ImageLoadThread;
+
+/**
+ * One decoding thread of an ImageLoadThread pool.
+ */
+
+class ImageLoadWorker : public QThread
+{
+private:
+
+	ImageLoadThread * _owner;
+
+public:
+
+	ImageLoadWorker( ImageLoadThread * owner ) : QThread(), _owner(owner) {}
+
+protected:
+
+	void run();
+};
+
+/**
+ * Loads images in the background using a pool of worker threads that
+ * share one priority queue.
+ *
+ * Results are delivered by the imageLoaded() signal, the workers never
+ * write into memory owned by the caller. Every item is tagged with the
+ * current generation; cancel() starts a new one without waiting, and the
+ * workers drop the results of older generations themselves.
+ */
+
+class ImageLoadThread : public QObject
 {
 Q_OBJECT
 
+friend class ImageLoadWorker;
+
 private:
 
 	ImageLoadQueue _in;
-	int _load;
+	QList<ImageLoadWorker*> _workers;
+	int _load; // queued items + items being loaded
 	QMutex _load_mutex;
+	QWaitCondition _idle; // signaled when _load drops to 0
+	QAtomicInt _generation;
 
 	volatile bool _finished;
 
 public:
 
-	ImageLoadThread( void ) : QThread()
+	ImageLoadThread( void ) : QObject()
 	{
 		_finished = false;
 		_load = 0;
+		qRegisterMetaType<ImageLoadResult>("ImageLoadResult");
 	}
 
+	~ImageLoadThread( void );
+
 public:
 
-	void run();
+	void start( int number_of_workers = 0 );
+	void wait( void );
 
 private:
 
-	QImage * _loadImage( QString name, int area_width, int area_height, bool force_size );
-	qreal _getExifRotation( QString fullname, qreal * out_rotation, bool * out_mirror );
+	void _work( void );
+	void _itemDone( void );
+	QImage * _loadImage( const ImageLoadItem & ili, MetadataEntry & meta, bool indexed,
+		bool * from_preview = NULL );
+	QImage * _loadEmbeddedPreview( QString fullname, const ExifInfo & info,
+		const ImageLoadItem & ili, bool swap_wh );
+	static bool _readScaled( QImageReader & reader, QSize full, QSize size, QImage * img );
 
 public:
 
@@ -63,12 +116,25 @@ public:
 		return _in;
 	}
 
+	inline int numberOfWorkers( void )
+	{
+		return _workers.size();
+	}
+
+	inline int generation( void )
+	{
+		return _generation.loadAcquire();
+	}
+
 	inline void addLoadImage( ImageLoadItem & ili )
 	{
+		ili.generation = generation();
+		ili.queued_at = Metrics::now();
+		Metrics::record( Metrics::QUEUE_DEPTH, _in.count() );
 		_load_mutex.lock();
-		_load++;
+		if ( _in.push( ili ) )
+			_load++;
 		_load_mutex.unlock();
-		_in.push( ili );
 	}
 
 	inline bool isIdle( void )
@@ -81,13 +147,16 @@ public:
 
 	inline void waitUntilIdle( void )
 	{
-		while ( !isIdle() ) msleep(60);
+		_load_mutex.lock();
+		while ( _load > 0 )
+			_idle.wait( &_load_mutex );
+		_load_mutex.unlock();
 	}
 
 	inline void addDummyElement( void )
 	{
 		ImageLoadItem ili;
-		ili.destination = NULL;
+		ili.index = -1;
 		ili.w = ili.h = 0.0;
 		_in.push(ili);
 	}
@@ -95,20 +164,43 @@ public:
 	inline void stopThread( void )
 	{
 		_finished = true;
-		addDummyElement();
+		// wake up every worker
+		for ( int i = 0; i < _workers.size(); i++ )
+			addDummyElement();
 	}
 	
-	inline void clear( void )
+	// drops the queue and returns the items that were removed
+	inline QList<ImageLoadItem> clear( void )
 	{
+		// items already being loaded are still counted until they finish
 		_load_mutex.lock();
-		_in.clear();
-		// put dummy element
-		addDummyElement();
+		QList<ImageLoadItem> removed = _in.clear();
+		for ( int i = 0; i < removed.size(); i++ )
+			if ( removed[i].index >= 0 )
+				_load--;
+		if ( _load == 0 )
+			_idle.wakeAll();
 		_load_mutex.unlock();
+		return removed;
+	}
+
+	// drops the queue and the results of the items being loaded,
+	// returns immediately; returns the new generation
+	inline int cancel( void )
+	{
+		int g = _generation.fetchAndAddOrdered( 1 ) + 1;
+		clear();
+		return g;
 	}
 
 public:
 	static void fitImage( int & w, int & h, int fitw, int fith, bool shrink_only );
+
+signals:
+
+	// emitted from a worker thread for every item of the current generation
+	// (also when loading failed), connect it with Qt::QueuedConnection
+	void imageLoaded( ImageLoadResult result );
 };
 
 #endif
@@ -0,0 +1,173 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#include "ImageOrientation.h"
+#include <string.h>
+#include <algorithm>
+
+// side of the tiles copied by the 90 degree rotations, in pixels
+#define ROTATE_TILE 64
+
+namespace
+{
+
+// pixels are copied as opaque blocks of bytes, whatever the format
+template <int N>
+struct Pixel
+{
+	uchar v[N];
+};
+
+template <typename P>
+void mirrorRows( QImage & image )
+{
+	for ( int y = 0; y < image.height(); y++ )
+	{
+		P * line = (P*)image.scanLine( y );
+		std::reverse( line, line + image.width() );
+	}
+}
+
+template <typename P>
+void rotate180( QImage & image )
+{
+	int w = image.width();
+	int h = image.height();
+	for ( int y = 0; y < h / 2; y++ )
+	{
+		P * a = (P*)image.scanLine( y );
+		P * b = (P*)image.scanLine( h - 1 - y ) + w - 1;
+		for ( int x = 0; x < w; x++ )
+			std::swap( a[x], *( b - x ) );
+	}
+	if ( h % 2 )
+	{
+		P * line = (P*)image.scanLine( h / 2 );
+		std::reverse( line, line + w );
+	}
+}
+
+void flipRows( QImage & image )
+{
+	int h = image.height();
+	int bpl = image.bytesPerLine();
+	QByteArray tmp( bpl, 0 );
+	for ( int y = 0; y < h / 2; y++ )
+	{
+		uchar * a = image.scanLine( y );
+		uchar * b = image.scanLine( h - 1 - y );
+		memcpy( tmp.data(), a, bpl );
+		memcpy( a, b, bpl );
+		memcpy( b, tmp.constData(), bpl );
+	}
+}
+
+// dst is src turned on its side: dst(x,y) = src(sx,sy) with
+// 5: (y,x)  6: (y,h-1-x)  7: (w-1-y,h-1-x)  8: (w-1-y,x)
+template <typename P>
+void rotate90( const QImage & src, QImage & dst, int orientation )
+{
+	int sw = src.width();
+	int sh = src.height();
+	int sbpl = src.bytesPerLine();
+	int dbpl = dst.bytesPerLine();
+	const uchar * sbits = src.constBits();
+	uchar * dbits = dst.bits();
+
+	bool sx_is_y = ( orientation == 5 || orientation == 6 );
+	bool sy_is_x = ( orientation == 5 || orientation == 8 );
+	int step = sy_is_x ? sbpl : -sbpl;
+
+	// the destination is sh pixels wide and sw pixels high
+	for ( int ty = 0; ty < sw; ty += ROTATE_TILE )
+	{
+		int ey = qMin( ty + ROTATE_TILE, sw );
+		for ( int tx = 0; tx < sh; tx += ROTATE_TILE )
+		{
+			int ex = qMin( tx + ROTATE_TILE, sh );
+			int sy = sy_is_x ? tx : sh - 1 - tx;
+			for ( int y = ty; y < ey; y++ )
+			{
+				int sx = sx_is_y ? y : sw - 1 - y;
+				const uchar * s = sbits + (qint64)sy * sbpl + sx * sizeof(P);
+				P * d = (P*)( dbits + (qint64)y * dbpl );
+				for ( int x = tx; x < ex; x++ )
+				{
+					d[x] = *(const P*)s;
+					s += step;
+				}
+			}
+		}
+	}
+}
+
+template <typename P>
+void applyPixels( QImage & image, int orientation )
+{
+	switch ( orientation )
+	{
+		case 2:
+			mirrorRows<P>( image );
+			break;
+		case 3:
+			rotate180<P>( image );
+			break;
+		case 4:
+			flipRows( image );
+			break;
+		default:
+		{
+			QImage dst( image.height(), image.width(), image.format() );
+			if ( dst.isNull() )
+				return;
+			dst.setColorTable( image.colorTable() );
+			dst.setDotsPerMeterX( image.dotsPerMeterY() );
+			dst.setDotsPerMeterY( image.dotsPerMeterX() );
+			rotate90<P>( image, dst, orientation );
+			image = dst;
+			break;
+		}
+	}
+}
+
+} // namespace
+
+void ImageOrientation::apply( QImage & image, int orientation )
+{
+	if ( image.isNull() || orientation < 2 || orientation > 8 )
+		return;
+
+	// 1 bit images are rare (and small), give them whole bytes per pixel
+	if ( image.depth() < 8 )
+		image = image.convertToFormat( QImage::Format_Indexed8 );
+
+	switch ( image.depth() )
+	{
+		case 8:  applyPixels< Pixel<1> >( image, orientation ); break;
+		case 16: applyPixels< Pixel<2> >( image, orientation ); break;
+		case 24: applyPixels< Pixel<3> >( image, orientation ); break;
+		case 32: applyPixels< quint32 >( image, orientation ); break;
+		case 64: applyPixels< quint64 >( image, orientation ); break;
+		default:
+			image = image.convertToFormat( QImage::Format_ARGB32 );
+			applyPixels< quint32 >( image, orientation );
+			break;
+	}
+}
@@ -0,0 +1,50 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#ifndef IMAGEORIENTATION_H
+#define IMAGEORIENTATION_H
+
+#include <QImage>
+
+/**
+ * Lossless EXIF orientation of decoded images.
+ *
+ * Mirrors and the 180 degree rotation swap pixels in place. The 90 and 270
+ * degree rotations (orientations 5-8) copy each pixel once into the
+ * rotated buffer, walking the image in small tiles so that both the source
+ * columns and the destination rows stay in the cache; the source buffer is
+ * released as soon as the copy is done. Pixels are moved, never resampled.
+ */
+
+class ImageOrientation
+{
+public:
+
+	// applies an EXIF orientation (1-8, anything else is ignored)
+	static void apply( QImage & image, int orientation );
+
+	// true if the orientation exchanges width and height
+	static inline bool swapsAxes( int orientation )
+	{
+		return orientation >= 5 && orientation <= 8;
+	}
+};
+
+#endif // IMAGEORIENTATION_H
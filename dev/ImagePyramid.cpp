@@ -0,0 +1,132 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#include "ImagePyramid.h"
+#include "ImageScaler.h"
+
+#include <QPainter>
+#include <math.h>
+
+ImagePyramid::ImagePyramid( const QImage & image )
+{
+    if ( image.isNull() )
+        return;
+
+    // tiles point into the level buffers, formats with 32 bit pixels draw fastest
+    QImage img = image;
+    if ( img.format() != QImage::Format_RGB32 && img.format() != QImage::Format_ARGB32_Premultiplied )
+        img = img.convertToFormat( img.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                         : QImage::Format_RGB32 );
+    _addLevel( img );
+
+    while ( img.width() > TILE_SIZE || img.height() > TILE_SIZE )
+    {
+        int w = ( img.width() + 1 ) / 2;
+        int h = ( img.height() + 1 ) / 2;
+        img = ImageScaler::downscale( img, w, h );
+        _addLevel( img );
+    }
+}
+
+int ImagePyramid::levelForZoom( double zoom ) const
+{
+    if ( _levels.isEmpty() || zoom >= 1.0 || zoom <= 0.0 )
+        return 0;
+    int index = (int)floor( log2( 1.0 / zoom ) );
+    if ( index >= _levels.size() ) index = _levels.size() - 1;
+    return index;
+}
+
+void ImagePyramid::draw( QPainter & painter, const QTransform & tr, const QRect & viewport ) const
+{
+    if ( _levels.isEmpty() )
+        return;
+
+    double zoom = sqrt( fabs( tr.determinant() ) );
+    const Level & l = _levels[levelForZoom( zoom )];
+    const QImage & base = _levels[0].image;
+
+    // map level pixels to original image pixels, then to the device
+    QTransform level_tr = QTransform::fromScale( (qreal)base.width() / l.image.width(),
+                                                 (qreal)base.height() / l.image.height() ) * tr;
+    bool invertible = false;
+    QTransform inverse = level_tr.inverted( &invertible );
+    if ( !invertible )
+        return;
+
+    // visible part of the level (bounding box, the image may be rotated)
+    QRect visible = inverse.mapRect( QRectF(viewport) ).toAlignedRect()
+                    & QRect( 0, 0, l.image.width(), l.image.height() );
+    if ( visible.isEmpty() )
+        return;
+
+    int c0 = visible.left() / TILE_SIZE;
+    int c1 = visible.right() / TILE_SIZE;
+    int r0 = visible.top() / TILE_SIZE;
+    int r1 = visible.bottom() / TILE_SIZE;
+
+    QTransform old_tr = painter.transform();
+    painter.setTransform( level_tr );
+    for ( int r = r0; r <= r1; r++ )
+    {
+        for ( int c = c0; c <= c1; c++ )
+        {
+            const Tile & tile = l.tiles[r * l.columns + c];
+            painter.drawImage( tile.rect.topLeft(), tile.view );
+        }
+    }
+    painter.setTransform( old_tr );
+}
+
+/*******************************************************************************
+ * PRIVATE METHODS
+ *******************************************************************************/
+
+void ImagePyramid::_addLevel( const QImage & image )
+{
+    Level l;
+    l.image = image;
+    l.columns = ( image.width() + TILE_SIZE - 1 ) / TILE_SIZE;
+    l.rows = ( image.height() + TILE_SIZE - 1 ) / TILE_SIZE;
+    l.tiles.reserve( l.columns * l.rows );
+
+    // constBits() does not detach, the views share the level buffer
+    const uchar * bits = l.image.constBits();
+    int bpl = l.image.bytesPerLine();
+    int depth = l.image.depth() / 8;
+    for ( int r = 0; r < l.rows; r++ )
+    {
+        for ( int c = 0; c < l.columns; c++ )
+        {
+            Tile t;
+            int x = c * TILE_SIZE;
+            int y = r * TILE_SIZE;
+            t.rect = QRect( x, y, qMin( TILE_SIZE, image.width() - x ), qMin( TILE_SIZE, image.height() - y ) );
+
+            // the next tile overdraws the extra pixels
+            int vw = qMin( t.rect.width() + 1, image.width() - x );
+            int vh = qMin( t.rect.height() + 1, image.height() - y );
+            t.view = QImage( bits + y * bpl + x * depth, vw, vh, bpl, image.format() );
+            l.tiles.append( t );
+        }
+    }
+
+    _levels.append( l );
+}
@@ -0,0 +1,93 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#ifndef IMAGEPYRAMID_H
+#define IMAGEPYRAMID_H
+
+#include <QImage>
+#include <QVector>
+#include <QTransform>
+#include <QRect>
+
+class QPainter;
+
+/**
+ * Multi-resolution copy of an image cut into square tiles.
+ *
+ * Level 0 shares the pixels of the original image, every other level is half
+ * the size of the previous one. Tiles are views into the level buffers (no
+ * pixels are copied), so drawing only touches the tiles that are visible, at
+ * the resolution closest to the zoom.
+ */
+
+class ImagePyramid
+{
+public:
+    static const int TILE_SIZE = 256;
+
+    ImagePyramid( void ) {}
+
+    // builds all the levels (slow for big images, call it from the load thread)
+    explicit ImagePyramid( const QImage & image );
+
+    // copies are cheap, the levels are shared
+    inline bool isNull( void ) const
+    {
+        return _levels.isEmpty();
+    }
+
+    inline int levelCount( void ) const
+    {
+        return _levels.size();
+    }
+
+    inline const QImage & level( int index ) const
+    {
+        return _levels[index].image;
+    }
+
+    // index of the smallest level that still has at least zoom * original size pixels
+    int levelForZoom( double zoom ) const;
+
+    // draws the tiles that intersect viewport; tr maps original image
+    // coordinates to the device (as for drawing the original image)
+    void draw( QPainter & painter, const QTransform & tr, const QRect & viewport ) const;
+
+private:
+    struct Tile
+    {
+        QRect rect;   // area covered in level coordinates
+        QImage view;  // pixels, one extra row/column to hide seams when filtering
+    };
+
+    struct Level
+    {
+        QImage image;
+        int columns;
+        int rows;
+        QVector<Tile> tiles; // row major
+    };
+
+    QVector<Level> _levels;
+
+    void _addLevel( const QImage & image );
+};
+
+#endif // IMAGEPYRAMID_H
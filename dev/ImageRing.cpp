@@ -0,0 +1,102 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#include "ImageRing.h"
+
+ImageRing::ImageRing( void )
+{
+    _budget = 512 * 1024 * 1024;
+    _bytes = 0;
+    _clock = 0;
+}
+
+void ImageRing::setBudget( qint64 bytes )
+{
+    _budget = bytes;
+    _evict();
+}
+
+bool ImageRing::get( const QString & name, QImage & image, ImagePyramid & pyramid )
+{
+    QHash<QString, Entry>::iterator it = _entries.find( name );
+    if ( it == _entries.end() )
+        return false;
+    it->used = ++_clock;
+    image = it->image;
+    pyramid = it->pyramid;
+    return true;
+}
+
+void ImageRing::touch( const QString & name )
+{
+    QHash<QString, Entry>::iterator it = _entries.find( name );
+    if ( it != _entries.end() )
+        it->used = ++_clock;
+}
+
+void ImageRing::insert( const QString & name, const QImage & image, const ImagePyramid & pyramid )
+{
+    remove( name );
+
+    Entry e;
+    e.image = image;
+    e.pyramid = pyramid;
+    e.bytes = image.sizeInBytes();
+    // level 0 of the pyramid shares the pixels of the image
+    for ( int i = 1; i < pyramid.levelCount(); i++ )
+        e.bytes += pyramid.level( i ).sizeInBytes();
+    e.used = ++_clock;
+    _entries.insert( name, e );
+    _bytes += e.bytes;
+    _evict();
+}
+
+void ImageRing::remove( const QString & name )
+{
+    QHash<QString, Entry>::iterator it = _entries.find( name );
+    if ( it == _entries.end() )
+        return;
+    _bytes -= it->bytes;
+    _entries.erase( it );
+}
+
+void ImageRing::clear( void )
+{
+    _entries.clear();
+    _bytes = 0;
+}
+
+/*******************************************************************************
+ * PRIVATE METHODS
+ *******************************************************************************/
+
+void ImageRing::_evict( void )
+{
+    // the most recently used image stays, even if it is over the budget alone
+    while ( _bytes > _budget && _entries.size() > 1 )
+    {
+        QHash<QString, Entry>::iterator oldest = _entries.begin();
+        for ( QHash<QString, Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it )
+            if ( it->used < oldest->used )
+                oldest = it;
+        _bytes -= oldest->bytes;
+        _entries.erase( oldest );
+    }
+}
@@ -0,0 +1,94 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#ifndef IMAGERING_H
+#define IMAGERING_H
+
+#include <QHash>
+#include <QImage>
+#include <QString>
+#include "ImagePyramid.h"
+
+/**
+ * Decoded images around the current one in the viewer, by file name.
+ *
+ * Holds the images prefetched ahead of the user and the ones viewed
+ * recently, within a memory budget; the least recently used are dropped
+ * first. Images and pyramids are implicitly shared, so handing one to the
+ * viewer does not copy pixels.
+ */
+
+class ImageRing
+{
+public:
+
+    ImageRing( void );
+
+    void setBudget( qint64 bytes );
+
+    inline qint64 budget( void ) const
+    {
+        return _budget;
+    }
+
+    inline qint64 bytes( void ) const
+    {
+        return _bytes;
+    }
+
+    inline int count( void ) const
+    {
+        return _entries.size();
+    }
+
+    inline bool contains( const QString & name ) const
+    {
+        return _entries.contains( name );
+    }
+
+    // returns false if the image is not in the ring; marks it as recently used
+    bool get( const QString & name, QImage & image, ImagePyramid & pyramid );
+
+    // marks the image as recently used
+    void touch( const QString & name );
+
+    void insert( const QString & name, const QImage & image, const ImagePyramid & pyramid );
+    void remove( const QString & name );
+    void clear( void );
+
+private:
+
+    struct Entry
+    {
+        QImage image;
+        ImagePyramid pyramid;
+        qint64 bytes = 0;
+        quint64 used = 0;
+    };
+
+    QHash<QString, Entry> _entries; // a handful of images, scanned linearly
+    qint64 _budget;
+    qint64 _bytes;
+    quint64 _clock;
+
+    void _evict( void );
+};
+
+#endif // IMAGERING_H
@@ -0,0 +1,554 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#include "ImageScaler.h"
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SCALER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// the SIMD kernels are compiled for their instruction set only, the
+// rest of the program keeps the default target
+#if defined(SCALER_X86) && defined(__GNUC__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+// the weights of one output pixel add up to 1 << WEIGHT_BITS
+#define WEIGHT_BITS 14
+
+// source pixels per output pixel at most in one pass: beyond that the
+// weights of single taps get too coarse (128 units of 1 << WEIGHT_BITS)
+#define MAX_RATIO 128
+
+// output rows per stripe at least, when the work is split between threads
+#define MIN_STRIPE_ROWS 16
+
+// the vertical pass keeps 7 bits of fraction: its results fit in a signed
+// 16 bit value and the horizontal sums in a signed 32 bit one
+#define COLUMN_SHIFT 7
+#define ROW_SHIFT ( 2 * WEIGHT_BITS - COLUMN_SHIFT )
+
+namespace
+{
+
+/**
+ * Source pixels covered by each output pixel along one direction.
+ * The weight rows are padded with zeros to a multiple of 4 taps, so the
+ * kernels can read taps in pairs or quads.
+ */
+
+struct Taps
+{
+	QVector<int> first; // first source pixel
+	QVector<int> count; // number of source pixels
+	QVector<qint16> weights; // stride weights per output pixel
+	int stride;
+};
+
+void computeTaps( int src, int dst, Taps & t )
+{
+	// output pixel i covers [i*src, (i+1)*src) and source pixel j covers
+	// [j*dst, (j+1)*dst), both in units of 1/dst source pixel
+	t.stride = ( src / dst + 2 + 3 ) & ~3;
+	t.first.resize( dst );
+	t.count.resize( dst );
+	t.weights.fill( 0, dst * t.stride );
+
+	for ( int i = 0; i < dst; i++ )
+	{
+		qint64 a = (qint64)i * src;
+		qint64 b = a + src;
+		int j0 = (int)( a / dst );
+		int j1 = (int)( ( b - 1 ) / dst );
+		qint16 * w = t.weights.data() + i * t.stride;
+
+		// each weight is the step between the rounded running sums of the
+		// overlaps: the sum is exact and no weight is off by more than one
+		// unit, however many taps share the rounding error
+		qint64 previous = 0;
+		for ( int j = j0; j <= j1; j++ )
+		{
+			qint64 covered = qMin( b, (qint64)( j + 1 ) * dst ) - a;
+			qint64 sum = ( ( covered << WEIGHT_BITS ) + src / 2 ) / src;
+			w[j - j0] = (qint16)( sum - previous );
+			previous = sum;
+		}
+		t.first[i] = j0;
+		t.count[i] = j1 - j0 + 1;
+	}
+}
+
+// vertical pass: out[i] = sum of weights[k] * rows[k][i], for n bytes
+typedef void (*ColumnKernel)( const uchar * const * rows, const qint16 * weights,
+	int count, int n, qint16 * out );
+
+// horizontal pass: one row of w output pixels from the vertical sums
+typedef void (*RowKernel)( const qint16 * in, const Taps & t, int w, uchar * out );
+
+inline qint16 columnValue( const uchar * const * rows, const qint16 * weights, int count, int i )
+{
+	qint32 s = 0;
+	for ( int k = 0; k < count; k++ )
+		s += weights[k] * rows[k][i];
+	return (qint16)( ( s + ( 1 << ( COLUMN_SHIFT - 1 ) ) ) >> COLUMN_SHIFT );
+}
+
+inline uchar rowValue( qint32 s )
+{
+	return (uchar)( ( s + ( 1 << ( ROW_SHIFT - 1 ) ) ) >> ROW_SHIFT );
+}
+
+void columnScalar( const uchar * const * rows, const qint16 * weights,
+	int count, int n, qint16 * out )
+{
+	for ( int i = 0; i < n; i++ )
+		out[i] = columnValue( rows, weights, count, i );
+}
+
+void rowScalar( const qint16 * in, const Taps & t, int w, uchar * out )
+{
+	for ( int x = 0; x < w; x++ )
+	{
+		const qint16 * p = in + t.first[x] * 4;
+		const qint16 * weights = t.weights.constData() + x * t.stride;
+		qint32 s[4] = { 0, 0, 0, 0 };
+		for ( int k = 0; k < t.count[x]; k++ )
+			for ( int c = 0; c < 4; c++ )
+				s[c] += weights[k] * p[k * 4 + c];
+		for ( int c = 0; c < 4; c++ )
+			out[x * 4 + c] = rowValue( s[c] );
+	}
+}
+
+#ifdef SCALER_X86
+
+// two 16 bit weights side by side, for _mm_madd_epi16 on interleaved pixels
+inline qint32 weightPair( const qint16 * w )
+{
+	return (qint32)( (quint16)w[0] | ( (quint32)(quint16)w[1] << 16 ) );
+}
+
+TARGET_SSE2
+void columnSse2( const uchar * const * rows, const qint16 * weights,
+	int count, int n, qint16 * out )
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32( 1 << ( COLUMN_SHIFT - 1 ) );
+	int i = 0;
+	for ( ; i + 16 <= n; i += 16 )
+	{
+		__m128i s0 = zero, s1 = zero, s2 = zero, s3 = zero;
+		for ( int k = 0; k < count; k += 2 )
+		{
+			// an odd last row is paired with itself, with a zero weight
+			const uchar * ra = rows[k];
+			const uchar * rb = k + 1 < count ? rows[k + 1] : ra;
+			__m128i wv = _mm_set1_epi32( weightPair( weights + k ) );
+			__m128i a = _mm_loadu_si128( (const __m128i*)( ra + i ) );
+			__m128i b = _mm_loadu_si128( (const __m128i*)( rb + i ) );
+			__m128i a_lo = _mm_unpacklo_epi8( a, zero );
+			__m128i a_hi = _mm_unpackhi_epi8( a, zero );
+			__m128i b_lo = _mm_unpacklo_epi8( b, zero );
+			__m128i b_hi = _mm_unpackhi_epi8( b, zero );
+			s0 = _mm_add_epi32( s0, _mm_madd_epi16( _mm_unpacklo_epi16( a_lo, b_lo ), wv ) );
+			s1 = _mm_add_epi32( s1, _mm_madd_epi16( _mm_unpackhi_epi16( a_lo, b_lo ), wv ) );
+			s2 = _mm_add_epi32( s2, _mm_madd_epi16( _mm_unpacklo_epi16( a_hi, b_hi ), wv ) );
+			s3 = _mm_add_epi32( s3, _mm_madd_epi16( _mm_unpackhi_epi16( a_hi, b_hi ), wv ) );
+		}
+		s0 = _mm_srai_epi32( _mm_add_epi32( s0, round ), COLUMN_SHIFT );
+		s1 = _mm_srai_epi32( _mm_add_epi32( s1, round ), COLUMN_SHIFT );
+		s2 = _mm_srai_epi32( _mm_add_epi32( s2, round ), COLUMN_SHIFT );
+		s3 = _mm_srai_epi32( _mm_add_epi32( s3, round ), COLUMN_SHIFT );
+		_mm_storeu_si128( (__m128i*)( out + i ), _mm_packs_epi32( s0, s1 ) );
+		_mm_storeu_si128( (__m128i*)( out + i + 8 ), _mm_packs_epi32( s2, s3 ) );
+	}
+	for ( ; i < n; i++ )
+		out[i] = columnValue( rows, weights, count, i );
+}
+
+// output pixels from x0 to x1 (excluded)
+TARGET_SSE2
+void rowRangeSse2( const qint16 * in, const Taps & t, int x0, int x1, uchar * out )
+{
+	const __m128i round = _mm_set1_epi32( 1 << ( ROW_SHIFT - 1 ) );
+	for ( int x = x0; x < x1; x++ )
+	{
+		const qint16 * p = in + t.first[x] * 4;
+		const qint16 * weights = t.weights.constData() + x * t.stride;
+		__m128i s = _mm_setzero_si128();
+		for ( int k = 0; k < t.count[x]; k += 2 )
+		{
+			// two pixels, interleaved channel by channel
+			__m128i v = _mm_loadu_si128( (const __m128i*)( p + k * 4 ) );
+			v = _mm_unpacklo_epi16( v, _mm_srli_si128( v, 8 ) );
+			s = _mm_add_epi32( s, _mm_madd_epi16( v, _mm_set1_epi32( weightPair( weights + k ) ) ) );
+		}
+		s = _mm_srai_epi32( _mm_add_epi32( s, round ), ROW_SHIFT );
+		s = _mm_packs_epi32( s, s );
+		s = _mm_packus_epi16( s, s );
+		*(qint32*)( out + x * 4 ) = _mm_cvtsi128_si32( s );
+	}
+}
+
+TARGET_SSE2
+void rowSse2( const qint16 * in, const Taps & t, int w, uchar * out )
+{
+	rowRangeSse2( in, t, 0, w, out );
+}
+
+TARGET_AVX2
+void columnAvx2( const uchar * const * rows, const qint16 * weights,
+	int count, int n, qint16 * out )
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i round = _mm256_set1_epi32( 1 << ( COLUMN_SHIFT - 1 ) );
+	int i = 0;
+	for ( ; i + 32 <= n; i += 32 )
+	{
+		// the unpacks work within 128 bit lanes: s0 holds bytes 0-3 and
+		// 16-19, s1 4-7 and 20-23, s2 8-11 and 24-27, s3 12-15 and 28-31
+		__m256i s0 = zero, s1 = zero, s2 = zero, s3 = zero;
+		for ( int k = 0; k < count; k += 2 )
+		{
+			const uchar * ra = rows[k];
+			const uchar * rb = k + 1 < count ? rows[k + 1] : ra;
+			__m256i wv = _mm256_set1_epi32( weightPair( weights + k ) );
+			__m256i a = _mm256_loadu_si256( (const __m256i*)( ra + i ) );
+			__m256i b = _mm256_loadu_si256( (const __m256i*)( rb + i ) );
+			__m256i a_lo = _mm256_unpacklo_epi8( a, zero );
+			__m256i a_hi = _mm256_unpackhi_epi8( a, zero );
+			__m256i b_lo = _mm256_unpacklo_epi8( b, zero );
+			__m256i b_hi = _mm256_unpackhi_epi8( b, zero );
+			s0 = _mm256_add_epi32( s0, _mm256_madd_epi16( _mm256_unpacklo_epi16( a_lo, b_lo ), wv ) );
+			s1 = _mm256_add_epi32( s1, _mm256_madd_epi16( _mm256_unpackhi_epi16( a_lo, b_lo ), wv ) );
+			s2 = _mm256_add_epi32( s2, _mm256_madd_epi16( _mm256_unpacklo_epi16( a_hi, b_hi ), wv ) );
+			s3 = _mm256_add_epi32( s3, _mm256_madd_epi16( _mm256_unpackhi_epi16( a_hi, b_hi ), wv ) );
+		}
+		s0 = _mm256_srai_epi32( _mm256_add_epi32( s0, round ), COLUMN_SHIFT );
+		s1 = _mm256_srai_epi32( _mm256_add_epi32( s1, round ), COLUMN_SHIFT );
+		s2 = _mm256_srai_epi32( _mm256_add_epi32( s2, round ), COLUMN_SHIFT );
+		s3 = _mm256_srai_epi32( _mm256_add_epi32( s3, round ), COLUMN_SHIFT );
+
+		// bytes 0-7 and 16-23, then 8-15 and 24-31; put the lanes in order
+		__m256i p01 = _mm256_packs_epi32( s0, s1 );
+		__m256i p23 = _mm256_packs_epi32( s2, s3 );
+		_mm256_storeu_si256( (__m256i*)( out + i ), _mm256_permute2x128_si256( p01, p23, 0x20 ) );
+		_mm256_storeu_si256( (__m256i*)( out + i + 16 ), _mm256_permute2x128_si256( p01, p23, 0x31 ) );
+	}
+	for ( ; i < n; i++ )
+		out[i] = columnValue( rows, weights, count, i );
+}
+
+TARGET_AVX2
+void rowAvx2( const qint16 * in, const Taps & t, int w, uchar * out )
+{
+	// two output pixels at a time, one per 128 bit lane, each lane doing
+	// what the SSE2 kernel does; the shorter one reads zero weights at the
+	// end (the next pixels are in the row or in its padding)
+	const __m256i round = _mm256_set1_epi32( 1 << ( ROW_SHIFT - 1 ) );
+	int x = 0;
+	for ( ; x + 2 <= w; x += 2 )
+	{
+		const qint16 * pa = in + t.first[x] * 4;
+		const qint16 * pb = in + t.first[x + 1] * 4;
+		const qint16 * wa = t.weights.constData() + x * t.stride;
+		const qint16 * wb = wa + t.stride;
+		int count = qMax( t.count[x], t.count[x + 1] );
+		__m256i s = _mm256_setzero_si256();
+		for ( int k = 0; k < count; k += 2 )
+		{
+			__m256i v = _mm256_inserti128_si256( _mm256_castsi128_si256(
+				_mm_loadu_si128( (const __m128i*)( pa + k * 4 ) ) ),
+				_mm_loadu_si128( (const __m128i*)( pb + k * 4 ) ), 1 );
+			v = _mm256_unpacklo_epi16( v, _mm256_srli_si256( v, 8 ) );
+			qint32 ka = weightPair( wa + k );
+			qint32 kb = weightPair( wb + k );
+			__m256i wv = _mm256_setr_epi32( ka, ka, ka, ka, kb, kb, kb, kb );
+			s = _mm256_add_epi32( s, _mm256_madd_epi16( v, wv ) );
+		}
+		s = _mm256_srai_epi32( _mm256_add_epi32( s, round ), ROW_SHIFT );
+		s = _mm256_packs_epi32( s, s );
+		s = _mm256_packus_epi16( s, s );
+		*(qint32*)( out + x * 4 ) = _mm_cvtsi128_si32( _mm256_castsi256_si128( s ) );
+		*(qint32*)( out + x * 4 + 4 ) = _mm_cvtsi128_si32( _mm256_extracti128_si256( s, 1 ) );
+	}
+	rowRangeSse2( in, t, x, w, out );
+}
+
+bool cpuHasAvx2( void )
+{
+#if defined(__GNUC__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports( "avx2" );
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid( info, 0 );
+	if ( info[0] < 7 )
+		return false;
+	__cpuid( info, 1 );
+	bool osxsave = ( info[2] & ( 1 << 27 ) ) != 0;
+	bool avx = ( info[2] & ( 1 << 28 ) ) != 0;
+	if ( !osxsave || !avx || ( _xgetbv( 0 ) & 6 ) != 6 )
+		return false; // the OS does not save the AVX registers
+	__cpuidex( info, 7, 0 );
+	return ( info[1] & ( 1 << 5 ) ) != 0;
+#else
+	return false;
+#endif
+}
+
+bool cpuHasSse2( void )
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	return true;
+#elif defined(__GNUC__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports( "sse2" );
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid( info, 1 );
+	return ( info[3] & ( 1 << 26 ) ) != 0;
+#else
+	return false;
+#endif
+}
+
+#endif // SCALER_X86
+
+/**
+ * One downscale split in stripes of output rows. Every output row depends
+ * only on its own taps, so the stripes can be computed in any order by any
+ * thread and the image is the same as in one pass. Helpers that start
+ * after the last stripe was taken only look at the counter: they keep the
+ * state alive through the shared pointer.
+ */
+
+struct Stripes
+{
+	QImage src; // keep the buffers alive until the last stripe is done
+	QImage dst;
+	int src_w; // the threads read the sizes here, not from the images
+	int dst_w;
+	int dst_h;
+	const uchar * src_bits;
+	int src_bpl;
+	uchar * dst_bits;
+	int dst_bpl;
+	Taps tx, ty;
+	ColumnKernel column;
+	RowKernel row;
+	int stripe_rows;
+	int stripes;
+	QAtomicInt next;
+	QSemaphore done;
+};
+
+void runStripes( Stripes & s )
+{
+	// vertical sums of one output row, with 4 zero pixels after the end
+	// for the taps the row kernels read past the last one
+	int sw = s.src_w;
+	int h = s.dst_h;
+	QVector<qint16> sums( ( sw + 4 ) * 4, 0 );
+	QVector<const uchar*> rows( s.ty.stride );
+
+	int stripe;
+	while ( ( stripe = s.next.fetchAndAddRelaxed( 1 ) ) < s.stripes )
+	{
+		int y1 = qMin( ( stripe + 1 ) * s.stripe_rows, h );
+		for ( int y = stripe * s.stripe_rows; y < y1; y++ )
+		{
+			for ( int k = 0; k < s.ty.count[y]; k++ )
+				rows[k] = s.src_bits + (qint64)( s.ty.first[y] + k ) * s.src_bpl;
+			s.column( rows.constData(), s.ty.weights.constData() + y * s.ty.stride,
+				s.ty.count[y], sw * 4, sums.data() );
+			s.row( sums.constData(), s.tx, s.dst_w, s.dst_bits + (qint64)y * s.dst_bpl );
+		}
+		s.done.release();
+	}
+}
+
+class StripeJob : public QRunnable
+{
+public:
+
+	StripeJob( const QSharedPointer<Stripes> & stripes ) : _stripes( stripes ) {}
+
+	void run()
+	{
+		runStripes( *_stripes );
+	}
+
+private:
+
+	QSharedPointer<Stripes> _stripes;
+};
+
+QThreadPool * createStripePool( void )
+{
+	QThreadPool * pool = new QThreadPool();
+	pool->setMaxThreadCount( qMax( QThread::idealThreadCount(), 1 ) );
+	return pool;
+}
+
+QThreadPool * stripePool( void )
+{
+	static QThreadPool * pool = createStripePool();
+	return pool;
+}
+
+} // namespace
+
+QImage ImageScaler::downscale( const QImage & image, int w, int h )
+{
+	return downscale( image, w, h, bestKernel() );
+}
+
+QImage ImageScaler::downscale( const QImage & image, int w, int h, Kernel kernel, int threads )
+{
+	if ( image.isNull() || w <= 0 || h <= 0 )
+		return QImage();
+	if ( w == image.width() && h == image.height() )
+		return image;
+	if ( w > image.width() || h > image.height() )
+		return image.scaled( w, h, Qt::IgnoreAspectRatio, Qt::SmoothTransformation );
+
+	// a bigger reduction goes through an integer multiple of the output
+	// size: the output pixels then cover whole pixels of the first pass and
+	// the two area averages give the one of the source
+	int kx = (int)( ( image.width() + (qint64)w * MAX_RATIO - 1 ) / ( (qint64)w * MAX_RATIO ) );
+	int ky = (int)( ( image.height() + (qint64)h * MAX_RATIO - 1 ) / ( (qint64)h * MAX_RATIO ) );
+	if ( kx > 1 || ky > 1 )
+	{
+		QImage first = downscale( image, kx > 1 ? w * kx : image.width(),
+		                          ky > 1 ? h * ky : image.height(), kernel, threads );
+		return downscale( first, w, h, kernel, threads );
+	}
+
+	QImage src = image;
+	if ( src.format() != QImage::Format_RGB32 && src.format() != QImage::Format_ARGB32_Premultiplied )
+		src = src.convertToFormat( src.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+		                                                 : QImage::Format_RGB32 );
+
+	ColumnKernel column = columnScalar;
+	RowKernel row = rowScalar;
+#ifdef SCALER_X86
+	if ( !isSupported( kernel ) )
+		kernel = SCALAR;
+	if ( kernel == SSE2 )
+	{
+		column = columnSse2;
+		row = rowSse2;
+	} else if ( kernel == AVX2 ) {
+		column = columnAvx2;
+		row = rowAvx2;
+	}
+#else
+	(void)kernel;
+#endif
+
+	QSharedPointer<Stripes> s( new Stripes );
+	s->dst = QImage( w, h, src.format() );
+	if ( s->dst.isNull() )
+		return QImage();
+	s->src = src;
+	s->src_w = src.width();
+	s->dst_w = w;
+	s->dst_h = h;
+	s->src_bits = s->src.constBits();
+	s->src_bpl = s->src.bytesPerLine();
+	s->dst_bits = s->dst.bits();
+	s->dst_bpl = s->dst.bytesPerLine();
+	computeTaps( src.width(), w, s->tx );
+	computeTaps( src.height(), h, s->ty );
+	s->column = column;
+	s->row = row;
+
+	// a few stripes per thread, so a thread that is late does not hold
+	// up the others for long
+	if ( threads <= 0 )
+		threads = QThread::idealThreadCount();
+	threads = qBound( 1, threads, qMax( h / MIN_STRIPE_ROWS, 1 ) );
+	s->stripes = threads > 1 ? threads * 4 : 1;
+	s->stripe_rows = ( h + s->stripes - 1 ) / s->stripes;
+	s->stripes = ( h + s->stripe_rows - 1 ) / s->stripe_rows;
+
+	// the calling thread works too
+	for ( int i = 1; i < threads; i++ )
+		stripePool()->start( new StripeJob( s ) );
+	runStripes( *s );
+	s->done.acquire( s->stripes );
+
+	// helpers that start late still hold the stripes: take the image out,
+	// so it is not shared with them (and not copied on the next write)
+	QImage out;
+	out.swap( s->dst );
+	s->src = QImage();
+	return out;
+}
+
+ImageScaler::Kernel ImageScaler::bestKernel( void )
+{
+	static Kernel best = isSupported( AVX2 ) ? AVX2 : isSupported( SSE2 ) ? SSE2 : SCALAR;
+	return best;
+}
+
+bool ImageScaler::isSupported( Kernel kernel )
+{
+	switch ( kernel )
+	{
+		case SCALAR:
+			return true;
+#ifdef SCALER_X86
+		case SSE2:
+			return cpuHasSse2();
+		case AVX2:
+			return cpuHasAvx2();
+#endif
+		default:
+			return false;
+	}
+}
+
+const char * ImageScaler::kernelName( Kernel kernel )
+{
+	switch ( kernel )
+	{
+		case SCALAR: return "scalar";
+		case SSE2: return "sse2";
+		case AVX2: return "avx2";
+		default: return "unknown";
+	}
+}
@@ -0,0 +1,64 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#ifndef IMAGESCALER_H
+#define IMAGESCALER_H
+
+#include <QImage>
+
+/**
+ * Area-averaging downscaler for 32 bit images.
+ *
+ * Every output pixel is the average of the source pixels it covers,
+ * weighted by the covered area, so big reductions (a photo down to a
+ * thumbnail) do not alias. Images with alpha are averaged premultiplied.
+ *
+ * The weights are fixed point and the sums are exact integers, so every
+ * kernel (scalar, SSE2, AVX2) gives the same result to the bit; the best
+ * one the processor supports is chosen at run time.
+ */
+
+class ImageScaler
+{
+public:
+
+	enum Kernel
+	{
+		SCALAR,
+		SSE2,
+		AVX2,
+		KERNEL_COUNT
+	};
+
+	// scales image to exactly w x h; enlarging (in either direction) is
+	// left to QImage::scaled()
+	static QImage downscale( const QImage & image, int w, int h );
+
+	// threads > 1 splits the output rows in stripes computed in parallel
+	// (0 = one thread per core); the result does not depend on it
+	static QImage downscale( const QImage & image, int w, int h, Kernel kernel, int threads = 1 );
+
+	// the fastest kernel the processor supports
+	static Kernel bestKernel( void );
+	static bool isSupported( Kernel kernel );
+	static const char * kernelName( Kernel kernel );
+};
+
+#endif // IMAGESCALER_H
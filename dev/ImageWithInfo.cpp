@@ -19,6 +19,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 *******************************************************************************/
 
 #include "ImageWithInfo.h"
+#include "ImagePyramid.h"
 
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -27,6 +28,7 @@ ImageWithInfo::~ImageWithInfo()
 {
     delete image;
     delete small_image;
+    delete pyramid;
 }
 
 ImageWithInfo& ImageWithInfo::operator=(ImageWithInfo &rhs) {
@@ -36,12 +38,16 @@ ImageWithInfo& ImageWithInfo::operator=(ImageWithInfo &rhs) {
     // Move images
     delete image;
     delete small_image;
+    delete pyramid;
     image = rhs.image;
     small_image = rhs.small_image;
+    pyramid = rhs.pyramid;
     rhs.image = nullptr;
     rhs.small_image = nullptr;
+    rhs.pyramid = nullptr;
 
     // Copy numerical values
+    full_size = rhs.full_size;
     zoom = rhs.zoom;
     posx = rhs.posx;
     posy = rhs.posy;
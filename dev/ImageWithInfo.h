@@ -25,6 +25,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QTransform>
 #include <QSize>
 
+class ImagePyramid;
+
 
 enum FitZoomMode
 {
@@ -37,7 +39,9 @@ class ImageWithInfo
 {
 public:
     QImage * image = nullptr;
-    QImage * small_image = nullptr;
+    QImage * small_image = nullptr; // shown scaled until image is decoded
+    QSize full_size; // size of image, while only small_image is there
+    ImagePyramid * pyramid = nullptr; // tiled copy of image, used for drawing
     double zoom = 1.0;
     int posx = 0;
     int posy = 0;
@@ -46,6 +50,8 @@ public:
     inline void clear( void )
     {
         image = small_image = 0;
+        pyramid = 0;
+        full_size = QSize();
         zoom = 1.0;
         recenter();
     }
@@ -0,0 +1,200 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#include "MetadataIndex.h"
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+// bump when the layout of the entries changes, old files are ignored
+static const quint32 INDEX_MAGIC   = 0x4d504958; // "MPIX"
+static const quint32 INDEX_VERSION = 2; // 2: mtime in ms on Unix too
+
+QMutex MetadataIndex::_mutex;
+QString MetadataIndex::_dir;
+QHash<QString,MetadataEntry> MetadataIndex::_entries;
+bool MetadataIndex::_modified = false;
+
+bool MetadataIndex::lookup( const QString & fullname, MetadataEntry & entry )
+{
+	MetadataEntry current;
+	if ( !_stat( fullname, current ) )
+		return false;
+
+	QFileInfo info( fullname );
+	QMutexLocker lock( &_mutex );
+	_use( info.absolutePath() );
+	QHash<QString,MetadataEntry>::const_iterator it = _entries.constFind( info.fileName() );
+	// another file renamed over this one keeps the name, maybe the size
+	// and mtime too (cp -p, rsync -t), not the inode
+	if ( it == _entries.constEnd() || it->size != current.size || it->mtime != current.mtime
+		|| it->inode != current.inode )
+		return false;
+	entry = *it;
+	return true;
+}
+
+void MetadataIndex::update( const QString & fullname, MetadataEntry entry )
+{
+	if ( !_stat( fullname, entry ) )
+		return;
+
+	QFileInfo info( fullname );
+	QMutexLocker lock( &_mutex );
+	_use( info.absolutePath() );
+	_entries.insert( info.fileName(), entry );
+	_modified = true;
+}
+
+void MetadataIndex::flush( void )
+{
+	QMutexLocker lock( &_mutex );
+	if ( _modified )
+		_save();
+}
+
+/*******************************************************************************
+* PRIVATE METHODS
+*******************************************************************************/
+
+bool MetadataIndex::_stat( const QString & fullname, MetadataEntry & entry )
+{
+#ifdef Q_OS_UNIX
+	struct stat st;
+	if ( stat( QFile::encodeName( fullname ).constData(), &st ) != 0 )
+		return false;
+	entry.size = st.st_size;
+	// milliseconds: a rewrite within the same second (an edited EXIF
+	// orientation keeps the size) must not match
+#ifdef Q_OS_MAC
+	entry.mtime = (qint64)st.st_mtimespec.tv_sec * 1000 + st.st_mtimespec.tv_nsec / 1000000;
+#else
+	entry.mtime = (qint64)st.st_mtim.tv_sec * 1000 + st.st_mtim.tv_nsec / 1000000;
+#endif
+	entry.inode = st.st_ino;
+#else
+	QFileInfo info( fullname );
+	if ( !info.exists() )
+		return false;
+	entry.size = info.size();
+	entry.mtime = info.lastModified().toMSecsSinceEpoch();
+	entry.inode = 0;
+#endif
+	return true;
+}
+
+void MetadataIndex::_use( const QString & dir )
+{
+	if ( dir == _dir )
+		return;
+	if ( _modified )
+		_save();
+	_dir = dir;
+	_load();
+}
+
+void MetadataIndex::_load( void )
+{
+	_entries.clear();
+	_modified = false;
+
+	QFile f( _indexFile( _dir ) );
+	if ( !f.open( QIODevice::ReadOnly ) )
+		return;
+
+	QDataStream ds( &f );
+	ds.setVersion( QDataStream::Qt_5_0 );
+	quint32 magic, version, count;
+	QString dir;
+	ds >> magic >> version >> dir >> count;
+	// another version, or a hash collision
+	if ( ds.status() != QDataStream::Ok || magic != INDEX_MAGIC
+		|| version != INDEX_VERSION || dir != _dir )
+		return;
+
+	for ( quint32 i = 0; i < count; i++ )
+	{
+		QString name;
+		MetadataEntry e;
+		qint32 width, height;
+		qint8 orientation;
+		qint64 capture_time;
+		quint8 failed;
+		ds >> name >> e.size >> e.mtime >> e.inode >> width >> height
+			>> orientation >> capture_time >> failed;
+		if ( ds.status() != QDataStream::Ok )
+		{
+			// truncated or corrupt: start again
+			_entries.clear();
+			return;
+		}
+		e.width = width;
+		e.height = height;
+		e.orientation = orientation;
+		if ( capture_time >= 0 )
+			e.capture_time = QDateTime::fromMSecsSinceEpoch( capture_time );
+		e.failed = ( failed != 0 );
+		_entries.insert( name, e );
+	}
+}
+
+void MetadataIndex::_save( void )
+{
+	_modified = false;
+	if ( _dir.isEmpty() )
+		return;
+
+	QString file_name = _indexFile( _dir );
+	QDir().mkpath( QFileInfo( file_name ).absolutePath() );
+
+	// QSaveFile renames on commit, a crash never leaves half an index
+	QSaveFile f( file_name );
+	if ( !f.open( QIODevice::WriteOnly ) )
+		return;
+
+	QDataStream ds( &f );
+	ds.setVersion( QDataStream::Qt_5_0 );
+	ds << INDEX_MAGIC << INDEX_VERSION << _dir << (quint32)_entries.size();
+	QHash<QString,MetadataEntry>::const_iterator it;
+	for ( it = _entries.constBegin(); it != _entries.constEnd(); ++it )
+	{
+		const MetadataEntry & e = it.value();
+		ds << it.key() << e.size << e.mtime << e.inode
+			<< (qint32)e.width << (qint32)e.height << (qint8)e.orientation
+			<< (qint64)( e.capture_time.isValid() ? e.capture_time.toMSecsSinceEpoch() : -1 )
+			<< (quint8)( e.failed ? 1 : 0 );
+	}
+	f.commit();
+}
+
+QString MetadataIndex::_indexFile( const QString & dir )
+{
+	return QStandardPaths::writableLocation( QStandardPaths::GenericCacheLocation )
+		+ "/mihphoto/index/"
+		+ QString::fromLatin1( QCryptographicHash::hash( dir.toUtf8(), QCryptographicHash::Md5 ).toHex() );
+}
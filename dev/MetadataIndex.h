@@ -0,0 +1,83 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#ifndef METADATAINDEX_H
+#define METADATAINDEX_H
+
+#include <QString>
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+
+/**
+ * What is known about an image file without reading it again.
+ * Valid only while the size, modification time and inode of the file match.
+ */
+
+struct MetadataEntry
+{
+	qint64 size = 0;
+	qint64 mtime = 0; // ms since the epoch
+	quint64 inode = 0;
+	int width = 0; // pixel dimensions, before the EXIF rotation
+	int height = 0;
+	int orientation = 1; // EXIF orientation (1-8)
+	QDateTime capture_time;
+	bool failed = false; // the image could not be decoded
+};
+
+/**
+ * Per-folder index of image metadata, kept in a binary file under the user
+ * cache directory so a folder that was opened before is laid out without
+ * probing the images again, and files that failed to decode are not decoded
+ * again until they change.
+ *
+ * The index of one folder is in memory at a time; it is written back when
+ * another folder is used and by flush(). All the methods are thread safe.
+ */
+
+class MetadataIndex
+{
+public:
+
+	// fills entry and returns true if the file has a valid entry
+	static bool lookup( const QString & fullname, MetadataEntry & entry );
+
+	// stores entry for the file (size, mtime and inode are set here)
+	static void update( const QString & fullname, MetadataEntry entry );
+
+	// writes the index if it was modified
+	static void flush( void );
+
+private:
+
+	static QMutex _mutex;
+	static QString _dir;
+	static QHash<QString,MetadataEntry> _entries;
+	static bool _modified;
+
+	static bool _stat( const QString & fullname, MetadataEntry & entry );
+	static void _use( const QString & dir );
+	static void _load( void );
+	static void _save( void );
+	static QString _indexFile( const QString & dir );
+};
+
+#endif // METADATAINDEX_H
@@ -0,0 +1,127 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#include "Metrics.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <stdio.h>
+
+static const char * COUNTER_NAMES[] = {
+	"images_loaded", "load_failures", "thumbnail_cache_hits",
+	"embedded_previews", "stale_results"
+};
+
+static const char * HISTOGRAM_NAMES[] = {
+	"queue_wait_us", "queue_depth", "thumbnail_cache_us", "exif_us", "open_us",
+	"decode_us", "preview_us", "rotate_us", "pyramid_us", "total_us"
+};
+
+QAtomicInteger<qint64> Metrics::_counters[COUNTER_COUNT];
+Metrics::Data Metrics::_histograms[HISTOGRAM_COUNT];
+
+// started with the static initializers, before main()
+static QElapsedTimer s_clock = []() { QElapsedTimer t; t.start(); return t; }();
+
+void Metrics::record( Histogram h, qint64 value )
+{
+	if ( value < 0 )
+		value = 0;
+	int bucket = 0;
+	while ( bucket < BUCKETS - 1 && ( value >> bucket ) != 0 )
+		bucket++;
+
+	Data & d = _histograms[h];
+	d.buckets[bucket].fetchAndAddRelaxed( 1 );
+	d.count.fetchAndAddRelaxed( 1 );
+	d.sum.fetchAndAddRelaxed( value );
+	qint64 m = d.max.loadRelaxed();
+	while ( value > m && !d.max.testAndSetRelaxed( m, value, m ) )
+		;
+}
+
+qint64 Metrics::now( void )
+{
+	return s_clock.nsecsElapsed() / 1000;
+}
+
+QJsonObject Metrics::toJson( void )
+{
+	QJsonObject counters;
+	for ( int i = 0; i < COUNTER_COUNT; i++ )
+		counters[COUNTER_NAMES[i]] = (double)_counters[i].loadRelaxed();
+
+	QJsonObject histograms;
+	for ( int i = 0; i < HISTOGRAM_COUNT; i++ )
+	{
+		Data & d = _histograms[i];
+		qint64 count = d.count.loadRelaxed();
+		QJsonObject h;
+		h["count"] = (double)count;
+		h["sum"] = (double)d.sum.loadRelaxed();
+		h["max"] = (double)d.max.loadRelaxed();
+
+		// percentiles as the upper bound of the bucket they fall in
+		QJsonArray buckets;
+		qint64 seen = 0;
+		const int ps[] = { 50, 90, 99 };
+		int next_p = 0;
+		for ( int b = 0; b < BUCKETS; b++ )
+		{
+			qint64 n = d.buckets[b].loadRelaxed();
+			if ( n == 0 )
+				continue;
+			seen += n;
+			qint64 upper = ( b == 0 ? 0 : ( (qint64)1 << b ) - 1 );
+			QJsonArray pair;
+			pair.append( (double)upper );
+			pair.append( (double)n );
+			buckets.append( pair );
+			while ( next_p < 3 && seen * 100 >= count * ps[next_p] )
+			{
+				h[QString("p%1").arg( ps[next_p] )] = (double)upper;
+				next_p++;
+			}
+		}
+		h["buckets"] = buckets; // [upper bound, count]
+		histograms[HISTOGRAM_NAMES[i]] = h;
+	}
+
+	QJsonObject o;
+	o["counters"] = counters;
+	o["histograms"] = histograms;
+	return o;
+}
+
+bool Metrics::save( const QString & file_name )
+{
+	QByteArray json = QJsonDocument( toJson() ).toJson();
+	if ( file_name == "-" )
+	{
+		fwrite( json.constData(), 1, json.size(), stdout );
+		fflush( stdout );
+		return true;
+	}
+	QFile f( file_name );
+	if ( !f.open( QIODevice::WriteOnly ) )
+		return false;
+	return f.write( json ) == json.size();
+}
@@ -0,0 +1,97 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QAtomicInteger>
+#include <QJsonObject>
+#include <QString>
+
+/**
+ * Process-wide counters and histograms of the load pipeline.
+ *
+ * Recording is a few relaxed atomic additions, so the workers can record
+ * every stage of every image. Histograms have log2 buckets (bucket i holds
+ * the values below 2^i), which is enough to tell whether a folder is slow
+ * because of I/O, decoding or rotation.
+ */
+
+class Metrics
+{
+public:
+
+	enum Counter
+	{
+		IMAGES_LOADED,
+		LOAD_FAILURES,
+		THUMBNAIL_CACHE_HITS,
+		EMBEDDED_PREVIEWS,
+		STALE_RESULTS,   // loaded for a cancelled generation
+		COUNTER_COUNT
+	};
+
+	enum Histogram
+	{
+		QUEUE_WAIT_US,
+		QUEUE_DEPTH,      // items waiting when one is added
+		THUMBNAIL_CACHE_US,
+		EXIF_US,
+		OPEN_US,          // opening the file and reading the image header
+		DECODE_US,        // reading and decoding the pixels (scaled decode included)
+		PREVIEW_US,       // reading and decoding an embedded preview
+		ROTATE_US,
+		PYRAMID_US,
+		TOTAL_US,         // whole item, in the worker
+		HISTOGRAM_COUNT
+	};
+
+	static const int BUCKETS = 40;
+
+	static inline void add( Counter c, qint64 n = 1 )
+	{
+		_counters[c].fetchAndAddRelaxed( n );
+	}
+
+	static void record( Histogram h, qint64 value );
+
+	// microseconds since the start of the program
+	static qint64 now( void );
+
+	static QJsonObject toJson( void );
+
+	// writes toJson() to the file (stdout if "-")
+	static bool save( const QString & file_name );
+
+private:
+
+	struct Data
+	{
+		QAtomicInteger<qint64> buckets[BUCKETS];
+		QAtomicInteger<qint64> count;
+		QAtomicInteger<qint64> sum;
+		QAtomicInteger<qint64> max;
+	};
+
+	static QAtomicInteger<qint64> _counters[COUNTER_COUNT];
+	static Data _histograms[HISTOGRAM_COUNT];
+};
+
+#endif // METRICS_H
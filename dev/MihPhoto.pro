@@ -3,7 +3,13 @@ QT       += core gui svg
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 TEMPLATE = app
 
+# loadRelaxed()/storeRelaxed() of the atomics need Qt 5.14
+!versionAtLeast(QT_VERSION, 5.14.0): error("MihPhoto needs Qt 5.14 or later")
+
 DEFINES += VERSION=1.12
+
+# qmake CONFIG+=trace: record a timeline for --trace
+trace: DEFINES += MIH_TRACE
 VERSION = 1.12
 
 TARGET = MihPhoto
@@ -24,7 +30,22 @@ SOURCES += \
     ConfigDialog.cpp \
     Config.cpp \
     Trashcan.cpp \
-    ScreenSettings.cpp
+    ScreenSettings.cpp \
+    ThumbnailCache.cpp \
+    ExifReader.cpp \
+    ImagePyramid.cpp \
+    DisplayCache.cpp \
+    ThumbnailStore.cpp \
+    DirectoryScanner.cpp \
+    MetadataIndex.cpp \
+    ImageRing.cpp \
+    Benchmark.cpp \
+    Metrics.cpp \
+    Trace.cpp \
+    Animation.cpp \
+    ImageOrientation.cpp \
+    ImageScaler.cpp \
+    SelfTest.cpp
 
 HEADERS  += \
     TouchUI.h \
@@ -41,7 +62,22 @@ HEADERS  += \
     ConfigDialog.h \
     Config.h \
     Trashcan.h \
-    ScreenSettings.h
+    ScreenSettings.h \
+    ThumbnailCache.h \
+    ExifReader.h \
+    ImagePyramid.h \
+    DisplayCache.h \
+    ThumbnailStore.h \
+    DirectoryScanner.h \
+    MetadataIndex.h \
+    ImageRing.h \
+    Benchmark.h \
+    Metrics.h \
+    Trace.h \
+    Animation.h \
+    ImageOrientation.h \
+    ImageScaler.h \
+    SelfTest.h
 
 OTHER_FILES += \
     MihPhoto.rc
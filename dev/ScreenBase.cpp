@@ -25,6 +25,11 @@ ScreenBase::ScreenBase( void ) : QObject()
 {
     m_size = QSize(0,0);
 	m_current_index = 0;
+	m_scan_generation = 0;
+	connect( &m_scanner, SIGNAL(batch(int,QStringList,QStringList)),
+		this, SLOT(_onScanBatch(int,QStringList,QStringList)), Qt::QueuedConnection );
+	connect( &m_scanner, SIGNAL(scanFinished(int)),
+		this, SLOT(_onScanFinished(int)), Qt::QueuedConnection );
 }
 
 ScreenBase::~ScreenBase( void )
@@ -36,13 +41,14 @@ void ScreenBase::loadFiles( QString dir, QString current_file )
 {
 	g_config.current_dir = dir;
 	g_config.last_open_dir = dir;
-	QDir myDir( dir );
-	QStringList name_filters;
-	name_filters << "*.jpg" << "*.jpeg" << "*.png" << "*.bmp"  << "*.tif"  << "*.gif";
 
-	onSetFiles( dir,
-		myDir.entryList( name_filters, QDir::Files | QDir::Readable, QDir::Name | QDir::IgnoreCase ),
-		current_file );
+	// the files arrive in batches from the scanner thread
+	m_scan_dir = dir;
+	m_scan_current = current_file;
+	m_scan_files.clear();
+	m_scan_folders.clear();
+	m_scan_generation = m_scanner.scan( dir );
+	onScanStarted( dir, current_file );
 }
 
 void ScreenBase::reloadFiles( void )
@@ -59,6 +65,22 @@ void ScreenBase::changeFromOtherViewer( ScreenBase * other )
 {
 	if ( other == NULL ) return;
 
+	// the files come from the other viewer now
+	m_scanner.stop();
+	m_scan_generation = 0;
+
+	if ( other->isScanning() )
+	{
+		// the listing is not complete, do it again for this viewer
+		other->m_scanner.stop();
+		other->m_scan_generation = 0;
+		loadFiles( other->m_scan_dir, other->getCurrentFile() );
+		m_action.copyParameters( other->m_action );
+		onResize();
+		return;
+	}
+
+	m_folders = other->m_folders;
 	onSetFiles( other->getDirName(),
 		other->getFiles(), other->getCurrentFile() );
 	m_action.copyParameters( other->m_action );
@@ -71,3 +93,44 @@ QString ScreenBase::getCurrentFile( void )
 		return m_files.at( m_current_index );
 	return QString("");
 }
+
+void ScreenBase::onScanStarted( QString dir_name, QString current )
+{
+	// show the requested file without waiting for the others
+	if ( !current.isEmpty() )
+		onSetFiles( dir_name, QStringList( current ), current );
+}
+
+void ScreenBase::onScanBatch( QStringList files, QStringList folders )
+{
+	Q_UNUSED( folders );
+	DirectoryScanner::merge( m_scan_files, files );
+}
+
+void ScreenBase::onScanFinished( void )
+{
+	onSetFiles( m_scan_dir, m_scan_files, m_scan_current );
+}
+
+/*******************************************************************************
+* PRIVATE SLOTS
+*******************************************************************************/
+
+void ScreenBase::_onScanBatch( int generation, QStringList files, QStringList folders )
+{
+	if ( generation != m_scan_generation )
+		return;
+	DirectoryScanner::merge( m_scan_folders, folders );
+	onScanBatch( files, folders );
+}
+
+void ScreenBase::_onScanFinished( int generation )
+{
+	if ( generation != m_scan_generation )
+		return;
+	m_scan_generation = 0;
+	m_folders = m_scan_folders;
+	onScanFinished();
+	m_scan_files.clear();
+	m_scan_folders.clear();
+}
@@ -24,6 +24,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QtGui>
 #include <QSize>
 #include "TouchMouseControl.h"
+#include "DirectoryScanner.h"
 
 /**
  * Base class for different UI states. (Settings screen, viewer screen, file browser...)
@@ -42,9 +43,18 @@ protected:
 
     QString m_dir_name;
     QStringList m_files;
+    QStringList m_folders; // subfolders of m_dir_name, as listed by the scanner
     int m_current_index;
     TouchMouseControl m_action;
 
+    // folder being listed by m_scanner
+    DirectoryScanner m_scanner;
+    int m_scan_generation;
+    QString m_scan_dir;
+    QString m_scan_current;
+    QStringList m_scan_files;
+    QStringList m_scan_folders;
+
 public:
 
     ScreenBase( void );
@@ -74,9 +84,21 @@ public:
     // public virtual methods
     virtual QString getCurrentFile( void );
 
+    // called while a folder is listed in the background; by default the
+    // files are collected and passed to onSetFiles() when the listing ends
+    virtual void onScanStarted( QString dir_name, QString current );
+    virtual void onScanBatch( QStringList files, QStringList folders );
+    virtual void onScanFinished( void );
+
+    inline bool isScanning( void )
+    {
+        return m_scan_generation != 0;
+    }
+
 signals:
 
     void updateSignal( void );
+    void updateRectSignal( QRect rect );
     void closeOnTouch( void );
     void changeFullscreen( void );
     void loadFile( void );
@@ -86,6 +108,11 @@ signals:
     void config( void );
     void indexChanged( int );
 
+private slots:
+
+    void _onScanBatch( int generation, QStringList files, QStringList folders );
+    void _onScanFinished( int generation );
+
 public:
 
     inline void update( void )
@@ -93,6 +120,11 @@ public:
         emit updateSignal();
     }
 
+    inline void update( const QRect & rect )
+    {
+        emit updateRectSignal( rect );
+    }
+
     inline int width( void )
     {
         return m_size.width();
@@ -23,6 +23,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "Config.h"
 #include "ScreenDirectory.h"
+#include "Trace.h"
+
+// room above and below a row strip for the border of the selected item
+#define STRIP_MARGIN 4
 
 ScreenDirectory::ScreenDirectory()
     : ScreenBase()
@@ -31,12 +35,14 @@ ScreenDirectory::ScreenDirectory()
   _scroll_pos = 0;
   _scroll_pos_dest = 0;
   _thumbs_per_row = 1;
+  _select_folder = false;
   _image_name_height = _computeImageNameHeight();
+  _strip_layout = GridLayout();
+  _strip_dpr = 0;
+  _strip_selection = -1;
 
   _resetUserActionsParameters();
 
-  _thumbs = NULL;
-  _last_number_of_loaded_images = 0;
 
     _ui.addAction( TouchUI::TOUCH_ACTION_OPEN, "document-open.svg" );
     _ui.addAction( TouchUI::TOUCH_ACTION_UP, "up.svg" );
@@ -46,6 +52,8 @@ ScreenDirectory::ScreenDirectory()
     _ui.addAction( TouchUI::TOUCH_ACTION_EXIT, "application-exit.svg" );
 
   _loadIcons();
+  connect( &_load_thread, SIGNAL(imageLoaded(ImageLoadResult)),
+    this, SLOT(_onImageLoaded(ImageLoadResult)), Qt::QueuedConnection );
   _load_thread.start();
 }
 
@@ -53,7 +61,6 @@ ScreenDirectory::~ScreenDirectory()
 {
   _load_thread.stopThread();
   _load_thread.wait();
-  _clearThumbs();
 }
 
 /*******************************************************************************
@@ -90,50 +97,32 @@ void ScreenDirectory::onSetFiles( QString dir_name, QStringList files, QString c
   }
 
   // load files
-  int priority = (int)files.size();
   if ( !same_files )
   {
-    // wait for load thread to become idle
-    _load_thread.clear();
-    _load_thread.waitUntilIdle();
+    // drop the old thumbnails still being loaded (without waiting)
+    _load_thread.cancel();
 
-    _clearThumbs();
     m_files = files;
     m_current_index = current_index;
-
-    // load new thumbs
-    _thumbs = new QImage*[ files.size() ];
-    for ( int i = 0; i < files.size(); i++ )
-    {
-      _thumbs[i] = NULL;
-      _addThumbnailToLoad( files.at(i), &_thumbs[i], priority-- );
-
-    }
+    _thumbs.reset( files.size() );
   } else {
-    // wait for load thread to become idle
-    _load_thread.clear();
-    _load_thread.waitUntilIdle();
+    // the thumbnails being loaded are still valid
+    _clearLoads();
 
     // update index
     m_current_index = current_index;
-
-    // load thumbnails for images that don't have one
-    for ( int i = 0; i < files.size(); i++ )
-    {
-      if ( _thumbs[i] == NULL )
-        _addThumbnailToLoad( files.at(i), &_thumbs[i], priority-- );
-
-    }
   }
 
-  // get list of folders
+  // the visible thumbnails are requested when painting,
+  // load the ones around the current image in advance
+  _thumbs.setBudget( (qint64)g_config.thumbnail_memory * 1024 * 1024 );
+  _preloadThumbnails( current_index );
+
+  // the folders were listed by the scanner (of this screen or of the
+  // one the files come from), the folder is not read again here
   if ( g_config.show_folders )
   {
-    QDir myDir( dir_name );
-    QStringList name_filters;
-    _folders = myDir.entryList( name_filters, QDir::Dirs | QDir::Drives, QDir::Name | QDir::IgnoreCase );
-    _folders.removeAll(".");
-    _folders.removeAll("..");
+    _folders = m_folders;
     m_current_index += _folders.size();
 
     // however, if there is no image in this folder, select first folder
@@ -147,7 +136,6 @@ void ScreenDirectory::onSetFiles( QString dir_name, QStringList files, QString c
   // update positions
   //_scroll_pos = _scroll_pos_dest = 0;
   _updateThumbsLocations();
-  _last_number_of_loaded_images = 0;
 
   _resetUserActionsParameters();
   scrollToCurrent();
@@ -155,6 +143,7 @@ void ScreenDirectory::onSetFiles( QString dir_name, QStringList files, QString c
 
 void ScreenDirectory::onPaint( QPainter & painter )
 {
+  TRACE_SCOPE( "ScreenDirectory::onPaint" );
         QFont font = painter.font();
   int point_size = TouchUI::scaleUI(font.pointSize());
   font.setPointSize( point_size > 0 ? point_size : 1 );
@@ -184,154 +173,57 @@ void ScreenDirectory::onPaint( QPainter & painter )
     return;
   }
 
-  int th_width = (int)( g_config.thumb_size / 100.0 * width() );
-  int th_height = th_width * 3 / 4;
-  if ( g_config.thumbnails_square )
-    th_height = th_width;
-  int img_width = th_width;
-  int img_height = th_height;
-  if ( g_config.thumbnails_space )
+  GridLayout l = _gridLayout();
+  int img_width = l.image_width;
+  int img_height = l.image_height;
+  _validateStrips( l, painter.device()->devicePixelRatioF() );
+
+  // thumbnails that are visible but not loaded yet
+  QVector<int> missing_thumbs;
+
+  // only the items of the visible rows
+  int first_row, last_row;
+  _visibleRows( l, first_row, last_row );
+  int first_item = first_row * l.columns;
+  int last_item = qMin( l.items, ( last_row + 1 ) * l.columns );
+
+  // thumbnails are packed at about the cell size (not while pinching,
+  // so the atlas is not repacked at every step)
+  if ( !_zooming )
+    _thumbs.setSlotSize( ThumbnailStore::slotSizeFor( qMax( img_width, img_height ) ) );
+  _thumbs.beginFrame();
+  for ( int row = first_row; row <= last_row; row++ )
   {
-    img_width = img_width * 90 / 100;
-    img_height = img_height * 90 / 100;
-  }
-
-  int priority = (int)m_files.size();
-  ImageLoadQueue & q = _load_thread.getQueue();
-  q.clearPriorities();
-
-  int number_of_items = m_files.size() + _folders.size();
-
-  for ( int i = 0; i < number_of_items; i++ )
-  {
-    // is it an image or a folder
-    bool is_image = ( i >= _folders.size() );
-
-    // top-left corner of thumb area
-    int x = th_width * ( i % _thumbs_per_row );
-    int y = _ui.height()
-      + ( th_height + _image_name_height ) * ( i / _thumbs_per_row )
-      - _scroll_pos;
-
-    // don't draw items outside the screen
-    if ( y > height() ) break;
-    if ( y + th_height + _image_name_height < 0 ) continue;
+    int y = l.top + l.row_height * row - _scroll_pos;
+    int first = row * l.columns;
+    int last = qMin( l.items, first + l.columns );
 
-    // center
-    int cx = x + th_width / 2;
-    int cy = y + th_height / 2;
+    // rows with all their thumbnails are drawn once, then only copied
+    QHash<int,QPixmap>::const_iterator strip = _strips.constFind( row );
+    if ( strip == _strips.constEnd() && !_zooming && _rowComplete( first, last ) )
+      strip = _strips.insert( row, _renderStrip( painter, l, row ) );
 
-    // draw scaled thumbnail
-    if ( is_image )
+    if ( strip != _strips.constEnd() )
     {
-      // it's an image
-      QImage * img = _thumbs[i-_folders.size()];
-      if ( img )
-      {
-        if ( g_config.thumbnails_crop )
-        {
-          QRectF target(cx-img_width/2, cy-img_height/2, img_width, img_height);
-          float w = (float)img->width();
-          float h = (float)img->height();
-          float w2 = (float)img_width * img->height() / (float)img_height;
-          float h2 = (float)img_height * img->width() / (float)img_width;
-          if ( w2 > w )
-          {
-            h = h2;
-          } else {
-            w = w2;
-          }
-          float dx = ( (float)img->width() - w ) /2;
-          float dy = ( (float)img->height() - h ) /2;
-          QRectF source(dx,dy, w,h);
-          /*
-          printf("Image %d,%d Source %.1f;%.1f;%.1f;%.1f Target %.1f;%.1f;%.1f;%.1f\n",
-            img->width(),img->height(),
-            source.x(),source.y(),source.width(),source.height(),
-            target.x(),target.y(),target.width(),target.height());
-          */
-          painter.drawImage(target, *img, source);
-
-        } else {
-          int w = img->width();
-          int h = img->height();
-          ImageLoadThread::fitImage( w,h, img_width, img_height, false );
-          QRectF r( cx-w/2, cy-h/2, w, h );
-          painter.drawImage( r, *img );
-        }
-
-      } else {
-        q.updatePriority( &_thumbs[i], priority-- );
-        QRectF thumb_rect( cx-img_width/2,cy-img_height/2,
-          img_width,img_height );
-        QBrush brush1( Qt::darkGray );
-        painter.setBrush( brush1 );
-        painter.setPen( Qt::transparent );
-        painter.drawRect( thumb_rect );
-      }
+      painter.drawPixmap( 0, y - STRIP_MARGIN, *strip );
+      _touchThumbnails( first, last );
     } else {
-      // it's a folder
-      int w = 512;
-      int h = 512;
-      ImageLoadThread::fitImage( w,h, img_width, img_height, false );
-      QRectF r( cx-w/2, cy-h/2, w, h );
-      _folder_icon.render( &painter, r );
+      for ( int i = first; i < last; i++ )
+        _drawItem( painter, l, i, y, missing_thumbs );
     }
+  }
 
-    // draw border for selected item
-    if ( i == m_current_index )
-    {
-      QBrush brush2( Qt::transparent );
-      QPen pen2( g_config.text_color );
-      pen2.setWidth(5);
-      painter.setBrush( brush2 );
-      painter.setPen( pen2 );
-      painter.drawRect( cx-img_width/2,cy-img_height/2,
-        img_width-4,img_height-3 );
-    }
-
-    // draw name
-    bool draw_name = g_config.thumbnails_show_name || !is_image;
-
-    if ( draw_name )
-    {
-      // get the name to be displayed
-      QString s;
-      if ( is_image )
-      {
-        // it's an image
-        s = m_files.at(i-_folders.size());
-      } else {
-        // it's a folder
-        s = _folders.at(i);
-      }
+  // keep the strips of one screen above and below
+  int screen_rows = last_row - first_row + 1;
+  _dropStrips( first_row - screen_rows, last_row + screen_rows );
 
-      // draw the name
-      painter.setPen( g_config.text_color );
-      QFontMetrics fm( painter.font() );
-      int h = fm.height();
-      if ( _image_name_height == 0 )
-      {
-        int x1 = x + (th_width - img_width)/2;
-        int y1 = y + (th_height - img_height)/2;
-        painter.setClipRect(x1,y1, img_width-15, h+4 );
-
-        painter.setPen( Qt::black );
-        painter.drawText( x1+0, y1+h+0, s );
-        painter.drawText( x1+0, y1+h+2, s );
-        painter.drawText( x1+2, y1+h+0, s );
-        painter.drawText( x1+2, y1+h+2, s );
-        painter.setPen( g_config.text_color );
-        painter.drawText( x1+1, y1+h+1, s );
-        //painter.drawText( x1, y1+h, s );
-      } else {
-        int x1 = x + (th_width - img_width);
-        int y1 = y + th_height;
-        painter.setClipRect(x1,y + th_height, img_width,_image_name_height );
-        painter.drawText( x1, y1+h, s );
-      }
-      painter.setClipRect( 0,0, width(), height() );
-    }
+  // load visible thumbnails first, then one screen above and below
+  _load_thread.getQueue().reprioritize( missing_thumbs, (int)m_files.size() );
+  if ( _thumbs.residentBytes() < _thumbs.budget() )
+  {
+    int screen = last_item - first_item;
+    _requestThumbnails( last_item, last_item + screen );
+    _requestThumbnails( first_item - screen, first_item );
   }
 
   // draw top menu
@@ -354,6 +246,148 @@ void ScreenDirectory::onPaint( QPainter & painter )
   }
 }
 
+// draws item i of the row whose top is at y
+void ScreenDirectory::_drawItem( QPainter & painter, const GridLayout & l, int i, int y,
+  QVector<int> & missing_thumbs )
+{
+  int th_width = l.cell_width;
+  int th_height = l.cell_height;
+  int img_width = l.image_width;
+  int img_height = l.image_height;
+
+  // is it an image or a folder
+  bool is_image = ( i >= _folders.size() );
+
+  // top-left corner of thumb area
+  int x = th_width * ( i % l.columns );
+
+  // center
+  int cx = x + th_width / 2;
+  int cy = y + th_height / 2;
+
+  // draw scaled thumbnail
+  if ( is_image )
+  {
+    // it's an image
+    // img is an atlas page, src the area of the thumbnail in it
+    int index = i-_folders.size();
+    QRect src;
+    const QImage * img = _thumbs.get( index, src );
+    if ( img )
+    {
+      if ( g_config.thumbnails_crop )
+      {
+        QRectF target(cx-img_width/2, cy-img_height/2, img_width, img_height);
+        float w = (float)src.width();
+        float h = (float)src.height();
+        float w2 = (float)img_width * src.height() / (float)img_height;
+        float h2 = (float)img_height * src.width() / (float)img_width;
+        if ( w2 > w )
+        {
+          h = h2;
+        } else {
+          w = w2;
+        }
+        float dx = src.x() + ( (float)src.width() - w ) /2;
+        float dy = src.y() + ( (float)src.height() - h ) /2;
+        QRectF source(dx,dy, w,h);
+        /*
+        printf("Image %d,%d Source %.1f;%.1f;%.1f;%.1f Target %.1f;%.1f;%.1f;%.1f\n",
+          img->width(),img->height(),
+          source.x(),source.y(),source.width(),source.height(),
+          target.x(),target.y(),target.width(),target.height());
+        */
+        painter.drawImage(target, *img, source);
+
+      } else {
+        int w = src.width();
+        int h = src.height();
+        ImageLoadThread::fitImage( w,h, img_width, img_height, false );
+        QRectF r( cx-w/2, cy-h/2, w, h );
+        painter.drawImage( r, *img, src );
+      }
+
+      // packed for smaller cells, load a sharper one
+      if ( _thumbs.needsLoad( index ) )
+        _addThumbnailToLoad( index );
+
+    } else {
+      if ( _thumbs.state( index ) == ThumbnailStore::EMPTY )
+        _addThumbnailToLoad( index ); // evicted, or never loaded
+      if ( _thumbs.state( index ) == ThumbnailStore::REQUESTED )
+        missing_thumbs.append( index );
+      QRectF thumb_rect( cx-img_width/2,cy-img_height/2,
+        img_width,img_height );
+      QBrush brush1( Qt::darkGray );
+      painter.setBrush( brush1 );
+      painter.setPen( Qt::transparent );
+      painter.drawRect( thumb_rect );
+    }
+  } else {
+    // it's a folder
+    int w = 512;
+    int h = 512;
+    ImageLoadThread::fitImage( w,h, img_width, img_height, false );
+    QRectF r( cx-w/2, cy-h/2, w, h );
+    _folder_icon.render( &painter, r );
+  }
+
+  // draw border for selected item
+  if ( i == m_current_index )
+  {
+    QBrush brush2( Qt::transparent );
+    QPen pen2( g_config.text_color );
+    pen2.setWidth(5);
+    painter.setBrush( brush2 );
+    painter.setPen( pen2 );
+    painter.drawRect( cx-img_width/2,cy-img_height/2,
+      img_width-4,img_height-3 );
+  }
+
+  // draw name
+  bool draw_name = g_config.thumbnails_show_name || !is_image;
+
+  if ( draw_name )
+  {
+    // get the name to be displayed
+    QString s;
+    if ( is_image )
+    {
+      // it's an image
+      s = m_files.at(i-_folders.size());
+    } else {
+      // it's a folder
+      s = _folders.at(i);
+    }
+
+    // draw the name
+    painter.setPen( g_config.text_color );
+    QFontMetrics fm( painter.font() );
+    int h = fm.height();
+    if ( _image_name_height == 0 )
+    {
+      int x1 = x + (th_width - img_width)/2;
+      int y1 = y + (th_height - img_height)/2;
+      painter.setClipRect(x1,y1, img_width-15, h+4 );
+
+      painter.setPen( Qt::black );
+      painter.drawText( x1+0, y1+h+0, s );
+      painter.drawText( x1+0, y1+h+2, s );
+      painter.drawText( x1+2, y1+h+0, s );
+      painter.drawText( x1+2, y1+h+2, s );
+      painter.setPen( g_config.text_color );
+      painter.drawText( x1+1, y1+h+1, s );
+      //painter.drawText( x1, y1+h, s );
+    } else {
+      int x1 = x + (th_width - img_width);
+      int y1 = y + th_height;
+      painter.setClipRect(x1,y + th_height, img_width,_image_name_height );
+      painter.drawText( x1, y1+h, s );
+    }
+    painter.setClipRect( 0,0, width(), height() );
+  }
+}
+
 void ScreenDirectory::onResize( void )
 {
   _updateThumbsLocations();
@@ -416,13 +450,8 @@ bool ScreenDirectory::onEvent( QEvent * event )
             if ( y > _ui.height() )
             {
               // select picture under mouse
-              int th_width = (int)( g_config.thumb_size / 100.0 * width() );
-              int th_height = th_width * 3 / 4;
-              int column = x / th_width;
-              int row = ( y + _scroll_pos - _ui.height() ) / ( th_height + _image_name_height );
-              int pos = row * _thumbs_per_row + column;
-              int number_of_items = m_files.size() + _folders.size();
-              if ( column < _thumbs_per_row && pos >= 0 && pos < number_of_items )
+              int pos = _itemAt( x, y );
+              if ( pos >= 0 )
               {
                 m_current_index = pos;
                 if ( pos < _folders.size() )
@@ -432,7 +461,7 @@ bool ScreenDirectory::onEvent( QEvent * event )
                 } else {
                   // it's an image
                   m_current_index -= _folders.size();
-                  _load_thread.clear();
+                  _clearLoads();
                   emit changeViewer();
                 }
               }
@@ -530,13 +559,8 @@ void ScreenDirectory::onTap( int x, int y )
   }
 
   // click on picture
-  int th_width = (int)( g_config.thumb_size / 100.0 * width() );
-  int th_height = th_width * 3 / 4;
-  int column = x / th_width;
-  int row = ( y + _scroll_pos - _ui.height() ) / ( th_height + _image_name_height );
-  int pos = row * _thumbs_per_row + column;
-  int number_of_items = m_files.size() + _folders.size();
-  if ( column < _thumbs_per_row && pos >= 0 && pos < number_of_items )
+  int pos = _itemAt( x, y );
+  if ( pos >= 0 )
   {
     m_current_index = pos;
     if ( pos < _folders.size() )
@@ -546,7 +570,7 @@ void ScreenDirectory::onTap( int x, int y )
     } else {
       // it's an image
       //m_current_index -= _folders.size();
-      _load_thread.clear();
+      _clearLoads();
       emit changeViewer();
     }
     return;
@@ -604,10 +628,6 @@ void ScreenDirectory::onMouseMove( QEvent * event )
 {
   QMouseEvent * mouseEvent = static_cast<QMouseEvent *>(event);
 
-  int th_width = (int)( g_config.thumb_size / 100.0 * width() );
-  int th_height = th_width * 3 / 4;
-  if ( g_config.thumbnails_square ) th_height = th_width;
-
   if ( _mouse_drag )
   {
     int dx0 = mouseEvent->x() - _mouse_start_x;
@@ -630,13 +650,12 @@ void ScreenDirectory::onMouseMove( QEvent * event )
         update();
     } else {
       // select picture under mouse
-      int column = mouseEvent->x() / th_width;
-      int row = ( mouseEvent->y() + _scroll_pos - _ui.height() ) / ( th_height + _image_name_height );
-      int pos = row * _thumbs_per_row + column;
-      int number_of_items = m_files.size() + _folders.size();
-      if ( column < _thumbs_per_row && pos >= 0 && pos < number_of_items )
+      int pos = _itemAt( mouseEvent->x(), mouseEvent->y() );
+      if ( pos >= 0 && pos != m_current_index )
+      {
         m_current_index = pos;
-      update();
+        update();
+      }
     }
         }
 
@@ -664,7 +683,7 @@ void ScreenDirectory::onKeyPress( QKeyEvent * event )
       } else {
         // it's an image
         //m_current_index -= _folders.size();
-        _load_thread.clear();
+        _clearLoads();
         emit changeViewer();
       }
       break;
@@ -787,19 +806,6 @@ void ScreenDirectory::onTimer( void )
   else
     _scroll_pos -= delta;
 
-  // also trigger a change if the load thread has loaded a new image
-  int img_loaded_count = 0;
-  for ( int i = 0; i < m_files.size(); i++ )
-  {
-    if ( _thumbs[i] != NULL )
-      img_loaded_count ++;
-  }
-  if ( img_loaded_count != _last_number_of_loaded_images)
-  {
-    _last_number_of_loaded_images = img_loaded_count;
-    change = true;
-  }
-
   if ( change )
     update();
 }
@@ -818,13 +824,10 @@ void ScreenDirectory::onSettingsChanged( void )
 
 void ScreenDirectory::scrollToCurrent( void )
 {
-  int th_width = (int)( g_config.thumb_size / 100.0 * width() );
-  int th_height = th_width * 3 / 4;
-  if ( g_config.thumbnails_square )
-    th_height = th_width;
-  th_height += _image_name_height;
+  GridLayout l = _gridLayout();
+  int th_height = l.row_height;
   int y = th_height
-    * ( m_current_index / _thumbs_per_row ) - _scroll_pos_dest;
+    * ( m_current_index / l.columns ) - _scroll_pos_dest;
 
   if ( y < 0 )
     _scroll_pos_dest = _scroll_pos_dest + y;
@@ -837,13 +840,12 @@ void ScreenDirectory::scrollToCurrent( void )
 
 QPoint ScreenDirectory::itemPosition(int i)
 {
-  int th_width = (int)( g_config.thumb_size / 100.0 * width() );
-  int th_height = th_width * 3 / 4;
+  GridLayout l = _gridLayout();
+  int th_width = l.cell_width;
+  int th_height = l.cell_height;
   // top-left corner of thumb area
-  int x = th_width * ( i % _thumbs_per_row );
-  int y = _ui.height()
-    + ( th_height + _image_name_height ) * ( i / _thumbs_per_row )
-    - _scroll_pos;
+  int x = th_width * ( i % l.columns );
+  int y = l.top + l.row_height * ( i / l.columns ) - _scroll_pos;
   return QPoint(x-width()/2+th_width/2,y-height()/2+th_height/2);
 }
 
@@ -859,6 +861,109 @@ void ScreenDirectory::changeIndex(int index)
   m_current_index = index + _folders.size();
 }
 
+void ScreenDirectory::onScanStarted( QString dir_name, QString current )
+{
+  // the grid is filled as the batches arrive
+  _load_thread.cancel();
+  m_dir_name = dir_name;
+  m_files.clear();
+  _folders.clear();
+  m_current_index = 0;
+  _thumbs.reset( 0 );
+  _thumbs.setBudget( (qint64)g_config.thumbnail_memory * 1024 * 1024 );
+  _select_name = current;
+  _select_folder = false;
+
+  _scroll_pos = _scroll_pos_dest = 0;
+  _updateThumbsLocations();
+  _resetUserActionsParameters();
+  update();
+}
+
+void ScreenDirectory::onScanBatch( QStringList files, QStringList folders )
+{
+  // remember the selected item, its index changes with the merge
+  QString selected;
+  bool selected_folder = m_current_index < _folders.size();
+  if ( selected_folder )
+    selected = _folders[m_current_index];
+  else if ( m_current_index - _folders.size() < m_files.size() )
+    selected = m_files[m_current_index - _folders.size()];
+
+  // the queued loads and the row strips refer to the old indexes
+  _clearLoads();
+  _strips.clear();
+
+  QVector<int> old_to_new;
+  DirectoryScanner::merge( m_files, files, &old_to_new );
+  _thumbs.remap( old_to_new, m_files.size() );
+  if ( g_config.show_folders )
+    DirectoryScanner::merge( _folders, folders );
+
+  bool found = false;
+  if ( !_select_name.isEmpty()
+    && DirectoryScanner::find( _select_folder ? _folders : m_files, _select_name ) >= 0 )
+  {
+    selected = _select_name;
+    selected_folder = _select_folder;
+    _select_name.clear();
+    found = true;
+  }
+  if ( !selected.isEmpty() )
+  {
+    int i = DirectoryScanner::find( selected_folder ? _folders : m_files, selected );
+    if ( i >= 0 )
+      m_current_index = selected_folder ? i : i + _folders.size();
+  }
+
+  // the scroll position stays where it is, the rows are only added
+  GridLayout l = _gridLayout();
+  _thumbs_per_row = l.columns;
+  _total_height = l.rows * l.row_height;
+  if ( found )
+    scrollToCurrent();
+  _limitScroll();
+  update();
+}
+
+void ScreenDirectory::onScanFinished( void )
+{
+  // the pending selection is not in this folder
+  _select_name.clear();
+  _preloadThumbnails( qMax( m_current_index - _folders.size(), 0 ) );
+  update();
+}
+
+/*******************************************************************************
+* PRIVATE SLOTS
+*******************************************************************************/
+
+void ScreenDirectory::_onImageLoaded( ImageLoadResult result )
+{
+  int index = result.index;
+  if ( result.generation != _load_thread.generation() )
+    return;
+  // files found by the scanner after the request shift the indexes
+  if ( index < 0 || index >= m_files.size() || m_files[index] != result.name )
+    index = DirectoryScanner::find( m_files, result.name );
+  if ( index < 0 )
+    return;
+  if ( result.image.isNull() )
+  {
+    _thumbs.setFailed( index );
+    return;
+  }
+  if ( _thumbs.state( index ) == ThumbnailStore::RESIDENT && !_thumbs.isBlurry( index ) )
+    return;
+  _thumbs.insert( index, result.image );
+  _strips.remove( ( index + _folders.size() ) / _gridLayout().columns );
+
+  // repaint only the cell of the new thumbnail, if it is visible
+  QRect r = _itemRect( index + _folders.size() );
+  if ( r.intersects( QRect( 0, 0, width(), height() ) ) )
+    update( r );
+}
+
 /*******************************************************************************
 * PRIVATE METHODS
 *******************************************************************************/
@@ -877,7 +982,7 @@ void ScreenDirectory::_handleTouchAction( TouchUI::UIAction action )
       emit loadDir();
       break;
         case TouchUI::TOUCH_ACTION_THUMBS:
-      _load_thread.clear();
+      _clearLoads();
       emit changeViewer();
       break;
         case TouchUI::TOUCH_ACTION_CONFIG:
@@ -897,21 +1002,13 @@ void ScreenDirectory::_updateThumbsLocations( void )
     _image_name_height = _computeImageNameHeight();
   else
     _image_name_height = 0;
+  _strips.clear();
 
   int old_pos = _scroll_pos_dest;
   int old_height = _total_height;
-  _thumbs_per_row = (int)( 100.0 / g_config.thumb_size );
-  int th_width = (int)( g_config.thumb_size / 100.0 * width() );
-  int th_height = th_width * 3 / 4;
-  if ( g_config.thumbnails_square )
-    th_height = th_width;
-
-  int number_of_items = m_files.size() + _folders.size();
-  //int number_of_images = m_files.size();
-  int rows = number_of_items / _thumbs_per_row
-    + ( ( number_of_items % _thumbs_per_row != 0 ) ? 1 : 0 );
-  int row_height = th_height + _image_name_height;
-  _total_height = rows * row_height;
+  GridLayout l = _gridLayout();
+  _thumbs_per_row = l.columns;
+  _total_height = l.rows * l.row_height;
 
   int new_scroll = 0;
     if ( old_height > 0 )
@@ -946,29 +1043,140 @@ void ScreenDirectory::_loadIcons( void )
         }
 }
 
-void ScreenDirectory::_clearThumbs( void )
+void ScreenDirectory::_clearLoads( void )
 {
-  if ( _thumbs == NULL ) return;
-  for ( int i = 0; i < m_files.size(); i++ )
-    delete _thumbs[i];
-  delete[] _thumbs;
-  _thumbs = NULL;
+  // the thumbnails that were waiting can be requested again
+  QList<ImageLoadItem> removed = _load_thread.clear();
+  for ( int i = 0; i < removed.size(); i++ )
+  {
+    int index = removed[i].index;
+    if ( index >= 0 && index < _thumbs.count() )
+      _thumbs.setRequested( index, false );
+  }
 }
 
-void ScreenDirectory::_addThumbnailToLoad( const QString name, QImage ** location, int priority )
+void ScreenDirectory::_addThumbnailToLoad( int index, int priority )
 {
+  if ( !_thumbs.needsLoad( index ) )
+    return;
+  _thumbs.setRequested( index, true );
+
   ImageLoadItem ili;
-  ili.name = name;
-  ili.destination = location;
+  ili.dir = m_dir_name;
+  ili.name = m_files.at( index );
+  ili.index = index;
   //ili.w = width() / 3;
   //ili.h = height() / 3;
   ili.w = 512;
   ili.h = 512;
   ili.priority = priority;
   ili.force_fit_in_size = true;
+  ili.thumbnail = true;
+  // an embedded preview is good enough if it covers the displayed cell
+  QSize cell = _thumbnailImageSize();
+  ili.preview_w = cell.width();
+  ili.preview_h = cell.height();
   _load_thread.addLoadImage(ili);
 }
 
+void ScreenDirectory::_requestThumbnails( int first_item, int last_item )
+{
+  // items are folders first, then images
+  int first = qMax( first_item - _folders.size(), 0 );
+  int last = qMin( last_item - _folders.size(), m_files.size() );
+  for ( int i = first; i < last; i++ )
+    _addThumbnailToLoad( i );
+}
+
+void ScreenDirectory::_preloadThumbnails( int center )
+{
+  // as many thumbnails as fit in the memory budget
+  qint64 thumb_bytes = _thumbs.slotBytes();
+  int n = (int)qMin( (qint64)m_files.size(), _thumbs.budget() / thumb_bytes );
+  int first = qBound( 0, center - n / 2, m_files.size() - n );
+  for ( int i = first; i < first + n; i++ )
+    _addThumbnailToLoad( i );
+}
+
+void ScreenDirectory::_validateStrips( const GridLayout & l, qreal dpr )
+{
+  // the strips are drawn for one layout and one selected item
+  if ( l.columns != _strip_layout.columns || l.cell_width != _strip_layout.cell_width
+    || l.cell_height != _strip_layout.cell_height || l.row_height != _strip_layout.row_height
+    || l.image_width != _strip_layout.image_width || l.image_height != _strip_layout.image_height
+    || dpr != _strip_dpr )
+  {
+    _strips.clear();
+    _strip_layout = l;
+    _strip_dpr = dpr;
+  }
+  if ( m_current_index != _strip_selection )
+  {
+    if ( _strip_selection >= 0 )
+      _strips.remove( _strip_selection / l.columns );
+    _strips.remove( m_current_index / l.columns );
+    _strip_selection = m_current_index;
+  }
+}
+
+bool ScreenDirectory::_rowComplete( int first, int last )
+{
+  // every thumbnail is there (and sharp), or cannot be loaded
+  for ( int i = qMax( first, _folders.size() ); i < last; i++ )
+  {
+    int index = i - _folders.size();
+    ThumbnailStore::State state = _thumbs.state( index );
+    if ( state == ThumbnailStore::FAILED )
+      continue;
+    if ( state != ThumbnailStore::RESIDENT || _thumbs.isBlurry( index ) )
+      return false;
+  }
+  return true;
+}
+
+QPixmap ScreenDirectory::_renderStrip( QPainter & painter, const GridLayout & l, int row )
+{
+  TRACE_SCOPE( "ScreenDirectory::_renderStrip" );
+  QPixmap strip( QSize( l.columns * l.cell_width, l.row_height + 2 * STRIP_MARGIN ) * _strip_dpr );
+  strip.setDevicePixelRatio( _strip_dpr );
+  strip.fill( Qt::transparent );
+
+  QPainter p( &strip );
+  p.setRenderHints( painter.renderHints() );
+  p.setFont( painter.font() );
+  QVector<int> missing_thumbs;
+  int first = row * l.columns;
+  int last = qMin( l.items, first + l.columns );
+  for ( int i = first; i < last; i++ )
+    _drawItem( p, l, i, STRIP_MARGIN, missing_thumbs );
+  return strip;
+}
+
+void ScreenDirectory::_touchThumbnails( int first, int last )
+{
+  // the thumbnails of a drawn strip stay recently used; one that was
+  // dropped anyway is loaded again, and its row redrawn when it arrives
+  QRect src;
+  for ( int i = qMax( first, _folders.size() ); i < last; i++ )
+  {
+    int index = i - _folders.size();
+    if ( !_thumbs.get( index, src ) && _thumbs.state( index ) == ThumbnailStore::EMPTY )
+      _addThumbnailToLoad( index );
+  }
+}
+
+void ScreenDirectory::_dropStrips( int first_row, int last_row )
+{
+  QHash<int,QPixmap>::iterator it = _strips.begin();
+  while ( it != _strips.end() )
+  {
+    if ( it.key() < first_row || it.key() > last_row )
+      it = _strips.erase( it );
+    else
+      ++it;
+  }
+}
+
 void ScreenDirectory::_resetUserActionsParameters( void )
 {
   _mouse_start_x = _mouse_start_y = 0;
@@ -1037,21 +1245,12 @@ void ScreenDirectory::_changeToFolder( QString name )
     my_dir.cdUp();
   loadFiles( my_dir.absolutePath(), "" );
 
-  if ( g_config.show_folders )
+  // select the folder we came from when the scanner lists it
+  if ( g_config.show_folders && name == ".." )
   {
-    int number_of_items = _folders.size();
-    for ( int i = 0; i < number_of_items; i++ )
-    {
-      if ( _folders[i] == old_dir.dirName() )
-      {
-        m_current_index = i;
-        break;
-      }
-    }
+    _select_name = old_dir.dirName();
+    _select_folder = true;
   }
-
-  scrollToCurrent();
-  update();
 }
 
 QString ScreenDirectory::getCurrentFile( void )
@@ -1092,7 +1291,70 @@ void ScreenDirectory::_zoomOut( void )
   update();
 }
 
+QSize ScreenDirectory::_thumbnailImageSize( void )
+{
+  GridLayout l = _gridLayout();
+  return QSize( l.image_width, l.image_height );
+}
+
+GridLayout ScreenDirectory::_gridLayout( void )
+{
+  GridLayout l;
+  l.columns = (int)( 100.0 / g_config.thumb_size );
+  if ( l.columns < 1 ) l.columns = 1;
+  l.cell_width = (int)( g_config.thumb_size / 100.0 * width() );
+  l.cell_height = l.cell_width * 3 / 4;
+  if ( g_config.thumbnails_square )
+    l.cell_height = l.cell_width;
+  l.row_height = l.cell_height + _image_name_height;
+  l.image_width = l.cell_width;
+  l.image_height = l.cell_height;
+  if ( g_config.thumbnails_space )
+  {
+    l.image_width = l.image_width * 90 / 100;
+    l.image_height = l.image_height * 90 / 100;
+  }
+  l.top = _ui.height();
+  l.items = m_files.size() + _folders.size();
+  l.rows = ( l.items + l.columns - 1 ) / l.columns;
+  return l;
+}
+
+void ScreenDirectory::_visibleRows( const GridLayout & l, int & first, int & last )
+{
+  // rows that intersect [0, height()] at the current scroll position
+  if ( l.row_height <= 0 || l.rows == 0 )
+  {
+    first = 0;
+    last = -1;
+    return;
+  }
+  first = qMax( 0, ( _scroll_pos - l.top ) / l.row_height );
+  last = qMin( l.rows - 1, ( _scroll_pos - l.top + height() ) / l.row_height );
+}
+
+int ScreenDirectory::_itemAt( int x, int y )
+{
+  GridLayout l = _gridLayout();
+  int dy = y + _scroll_pos - l.top;
+  if ( x < 0 || dy < 0 || l.cell_width <= 0 || l.row_height <= 0 )
+    return -1;
+  int column = x / l.cell_width;
+  int pos = ( dy / l.row_height ) * l.columns + column;
+  if ( column < l.columns && pos < l.items )
+    return pos;
+  return -1;
+}
+
 int ScreenDirectory::_computeImageNameHeight( void )
 {
         return TouchUI::scaleUI(20);
 }
+
+QRect ScreenDirectory::_itemRect( int i )
+{
+  GridLayout l = _gridLayout();
+  int x = l.cell_width * ( i % l.columns );
+  int y = l.top + l.row_height * ( i / l.columns ) - _scroll_pos;
+  return QRect( x, y, l.cell_width, l.row_height );
+}
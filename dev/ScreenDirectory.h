@@ -21,11 +21,32 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef SCREENDIRECTORY_H
 #define SCREENDIRECTORY_H
 
+#include <QHash>
+#include <QPixmap>
 #include <QtSvg/QSvgRenderer>
 #include "ScreenBase.h"
 #include "ImageLoadThread.h"
+#include "ThumbnailStore.h"
 #include "TouchUI.h"
 
+/**
+ * Geometry of the thumbnail grid. All the rows have the same height, so
+ * the rows visible at a scroll position are computed directly.
+ */
+
+struct GridLayout
+{
+	int columns;      // items per row
+	int cell_width;
+	int cell_height;  // without the name under the thumbnail
+	int row_height;   // cell and name
+	int image_width;  // thumbnail area inside the cell
+	int image_height;
+	int top;          // y of the first row when not scrolled
+	int items;
+	int rows;
+};
+
 /**
  * UI state for browsing files.
  */
@@ -36,8 +57,10 @@ Q_OBJECT
 
 private:
 
-	QImage ** _thumbs;
+	ThumbnailStore _thumbs; // indexed like m_files
 	QStringList _folders;
+	QString _select_name; // item to select when the scanner finds it
+	bool _select_folder;
 
 	int _total_height;
 	int _scroll_pos;
@@ -48,10 +71,16 @@ private:
 	int _initial_scroll;
 	double _initial_thumb_size;
 	bool _dragging,_zooming;
+
+	// rendered rows (thumbnails, names and frames) by row number, so
+	// scrolling only copies them; dropped when one of their cells changes
+	QHash<int,QPixmap> _strips;
+	GridLayout _strip_layout;
+	qreal _strip_dpr;
+	int _strip_selection;
 	bool _two_fingers;
 	
 	ImageLoadThread _load_thread;
-	int _last_number_of_loaded_images;
 
 	TouchUI _ui;
 	QSvgRenderer _scroll_indicator;
@@ -82,6 +111,10 @@ public:
 	bool onEvent(QEvent *event);
 	void onSettingsChanged( void );
 
+	void onScanStarted( QString dir_name, QString current );
+	void onScanBatch( QStringList files, QStringList folders );
+	void onScanFinished( void );
+
 	void onDrag( const QTouchEvent::TouchPoint & point, bool end );
 	void onTwoFingers( const QTouchEvent::TouchPoint tp0,
 		const QTouchEvent::TouchPoint tp1 );
@@ -100,6 +133,20 @@ public:
 	QString getCurrentFile( void );
 	void changeIndex( int );
 
+	inline const ThumbnailStore & thumbnailStore( void )
+	{
+		return _thumbs;
+	}
+
+	inline ImageLoadThread & loadThread( void )
+	{
+		return _load_thread;
+	}
+
+private slots:
+
+	void _onImageLoaded( ImageLoadResult result );
+
 private:
 
     void _handleTouchAction( TouchUI::UIAction action );
@@ -107,9 +154,10 @@ private:
 	void _limitScroll( void );
 	void _limitScroll( int & scroll );
 	void _loadIcons( void );
-	void _clearThumbs( void );
-	void _addThumbnailToLoad( const QString name, QImage ** location,
-		int priority = 0 );
+	void _clearLoads( void );
+	void _addThumbnailToLoad( int index, int priority = 0 );
+	void _requestThumbnails( int first_item, int last_item );
+	void _preloadThumbnails( int center );
 	void _resetUserActionsParameters( void );
 	void _resetTouchParams( void );
 	void _updateScrollSpeed( int x, int y, bool reset = false );
@@ -118,6 +166,18 @@ private:
 	void _zoomIn( void );
 	void _zoomOut( void );
 	int _computeImageNameHeight( void );
+	QSize _thumbnailImageSize( void );
+	GridLayout _gridLayout( void );
+	void _visibleRows( const GridLayout & l, int & first, int & last );
+	QRect _itemRect( int i );
+	void _drawItem( QPainter & painter, const GridLayout & l, int i, int y,
+		QVector<int> & missing_thumbs );
+	void _validateStrips( const GridLayout & l, qreal dpr );
+	bool _rowComplete( int first, int last );
+	QPixmap _renderStrip( QPainter & painter, const GridLayout & l, int row );
+	void _touchThumbnails( int first, int last );
+	void _dropStrips( int first_row, int last_row );
+	int _itemAt( int x, int y );
 };
 
 #endif // SCREENDIRECTORY_H
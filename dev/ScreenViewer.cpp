@@ -26,12 +26,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "Config.h"
 #include "ScreenViewer.h"
 #include "Trashcan.h"
+#include "ImagePyramid.h"
+#include "Trace.h"
 
 ScreenViewer::ScreenViewer()
     : ScreenBase()
 {
 
     m_current_index = 0;
+    _direction = 1;
     _resetUserActionsParameters();
 
     _loadUI();
@@ -40,7 +43,9 @@ ScreenViewer::ScreenViewer()
     _zoom_out_icon.load( g_config.install_dir + "/icons/zoom-out.svg" );
     _zoom_indicator.load( g_config.install_dir + "/icons/position.svg" );
 
-    _last_load_thread_idle_state = true;
+    connect( &_display_cache, SIGNAL(ready()), this, SIGNAL(updateSignal()) );
+    connect( &_load_thread, SIGNAL(imageLoaded(ImageLoadResult)),
+             this, SLOT(_onImageLoaded(ImageLoadResult)), Qt::QueuedConnection );
 
     _load_thread.start();
     _show_ui = false;
@@ -59,7 +64,9 @@ ScreenViewer::~ScreenViewer()
 
 void ScreenViewer::forward( void )
 {
-    if ( !_changing && m_current_index < m_files.size() - 1 && _load_thread.isIdle() )
+    // a new move during the transition restarts it; an image that is not
+    // decoded yet shows "Loading" until it is (the loader is never waited for)
+    if ( m_current_index < m_files.size() - 1 )
     {
         _allow_drag = false;
         resetFitZoom( _current );
@@ -75,7 +82,7 @@ void ScreenViewer::forward( void )
 
 void ScreenViewer::back( void )
 {
-    if ( !_changing && m_current_index > 0 && _load_thread.isIdle() )
+    if ( m_current_index > 0 )
     {
         _allow_drag = false;
         resetFitZoom( _current );
@@ -91,12 +98,13 @@ void ScreenViewer::back( void )
 
 void ScreenViewer::gotoIndex( int new_index )
 {
-    if ( !_changing && m_current_index != new_index && _load_thread.isIdle() )
+    if ( !_changing && m_current_index != new_index )
     {
         _current.rotation = 0.0;
         _allow_drag = false;
         _drag_offset = 0;
         _drag_offset_y = 0;
+        _direction = ( new_index > m_current_index ? 1 : -1 );
         m_current_index = new_index;
         _reloadAll();
         emit indexChanged( new_index );
@@ -234,7 +242,10 @@ void ScreenViewer::resetView()
 
 void ScreenViewer::onSetFiles( QString dir_name, QStringList files, QString current )
 {
+    bool same_dir = ( m_dir_name == dir_name );
     m_dir_name = dir_name;
+    if ( !same_dir )
+        _ring.clear();
 
     // are these the same files
     bool same_files = true;
@@ -277,6 +288,21 @@ void ScreenViewer::onSetFiles( QString dir_name, QStringList files, QString curr
                 _reloadAll();
             }
         }
+    } else if ( same_dir && m_current_index < m_files.size() && current_index < files.size()
+                && m_files[m_current_index] == files[current_index] ) {
+        // the complete listing of the folder arrived after the current
+        // file, keep the current image (or its load) and add the neighbours;
+        // the queued items have indexes in the old list, drop them first
+        QList<ImageLoadItem> removed = _load_thread.clear();
+        for ( int j = 0; j < removed.size(); j++ )
+            _requested.remove( removed[j].name );
+        m_current_index = current_index;
+        m_files = files;
+        if ( _current.isNull() )
+            loadImage( m_current_index, _current );
+        loadImage( m_current_index-1, _previous );
+        loadImage( m_current_index+1, _next );
+        _prefetch();
     } else {
         m_current_index = current_index;
         m_files = files;
@@ -290,6 +316,7 @@ void ScreenViewer::onSetFiles( QString dir_name, QStringList files, QString curr
 
 void ScreenViewer::onPaint( QPainter & painter )
 {
+    TRACE_SCOPE( "ScreenViewer::onPaint" );
     int cx = width() / 2;
     int cy = height() / 2;
 
@@ -317,22 +344,35 @@ void ScreenViewer::onPaint( QPainter & painter )
         bool alternative_smooth = false;
         alternative_smooth = ( _current.rotation == 0.0
                                && _drag_offset == 0
-                               && _current.zoom == ZOOM_FIT
+                               && _current.zoom == _current.computeFitZoom( size() )
                                && g_config.smooth_images );
+
+        // the smooth rendering is made in background, until it is
+        // ready the image is drawn the normal way
+        QImage img2;
         if ( alternative_smooth )
-        {
-            QImage img2 = _current.image->transformed( tr, Qt::SmoothTransformation );
+            img2 = _display_cache.get( _current, painter.device()->devicePixelRatioF() );
+        else
+            _display_cache.clear();
 
-            qreal ox = (qreal)( (this->width() - img2.width()) / 2 ) + _current.posx + _drag_offset;
-            qreal oy = (qreal)( (this->height() - img2.height()) / 2 ) + _current.posy + _drag_offset_y;
+        if ( !img2.isNull() )
+        {
+            QSizeF size2 = QSizeF( img2.size() ) / img2.devicePixelRatioF();
+            qreal ox = (qreal)(int)( ( (qreal)this->width() - size2.width() ) / 2 ) + _current.posx + _drag_offset;
+            qreal oy = (qreal)(int)( ( (qreal)this->height() - size2.height() ) / 2 ) + _current.posy + _drag_offset_y;
             QPointF origin( ox, oy );
             painter.drawImage( origin, img2 );
+        } else if ( _current.pyramid != NULL ) {
+            // only the visible tiles, at the resolution closest to the zoom
+            _current.pyramid->draw( painter, tr, QRect( 0, 0, width(), height() ) );
         } else {
             painter.setTransform(tr);
             painter.drawImage( 0,0, *_current.image );
             painter.resetTransform();
         }
 
+    } else if ( _current.small_image != NULL ) {
+        _drawSmallImage( painter, _current, _drag_offset );
     } else {
         QString s1 = "", s2 = "";
         if ( m_files.empty() )
@@ -340,7 +380,7 @@ void ScreenViewer::onPaint( QPainter & painter )
             s1 = tr("No image.");
             s2 = tr("Click on the screen to bring the menu!");
         } else {
-            if ( _load_thread.isIdle() )
+            if ( !_requested.contains( m_files[m_current_index] ) )
             {
                 s1 = tr("Cannot load image.");
                 s2 = m_files[m_current_index];
@@ -374,7 +414,12 @@ void ScreenViewer::onPaint( QPainter & painter )
         int x = cx - sw/2 + _current.posx + _drag_offset + width();
         int y = cy - sh/2 + _current.posy;
         QRect r(x,y,sw,sh);
-        painter.drawImage( r, *_next.image );
+        if ( _next.pyramid != NULL )
+            _next.pyramid->draw( painter, _fitTransform( r, _next ), QRect( 0, 0, width(), height() ) );
+        else
+            painter.drawImage( r, *_next.image );
+    } else if ( _next.small_image != NULL && _drag_offset < 0 ) {
+        _drawSmallImage( painter, _next, _drag_offset + width() );
     }
 
     if ( !(_previous.isNull()) && _drag_offset > 0 )
@@ -386,7 +431,12 @@ void ScreenViewer::onPaint( QPainter & painter )
         int x = cx - sw/2 + _current.posx + _drag_offset - width();
         int y = cy - sh/2 + _current.posy;
         QRect r(x,y,sw,sh);
-        painter.drawImage( r, *_previous.image );
+        if ( _previous.pyramid != NULL )
+            _previous.pyramid->draw( painter, _fitTransform( r, _previous ), QRect( 0, 0, width(), height() ) );
+        else
+            painter.drawImage( r, *_previous.image );
+    } else if ( _previous.small_image != NULL && _drag_offset > 0 ) {
+        _drawSmallImage( painter, _previous, _drag_offset - width() );
     }
 
     if ( g_config.show_file_name )
@@ -629,15 +679,13 @@ void ScreenViewer::onPan( const QTouchEvent::TouchPoint & point, bool end )
                 // qDebug() << "Resetting stuff during pan";
             }
 
-            if ( dx < -g_config.flip_distance && m_current_index < m_files.size() - 1
-                 && _load_thread.isIdle() )
+            if ( dx < -g_config.flip_distance && m_current_index < m_files.size() - 1 )
             {
                 _drag_offset = dx + width();
                 _drag_offset_y = 0; //?
                 _moveForward();
             }
-            if ( dx > g_config.flip_distance && m_current_index > 0
-                 && _load_thread.isIdle() )
+            if ( dx > g_config.flip_distance && m_current_index > 0 )
             {
                 _drag_offset = dx - width();
                 _drag_offset_y = 0; //?
@@ -794,13 +842,13 @@ void ScreenViewer::onMouseReleased( QEvent * event )
             // dragging the menu
             // nothing for now
         } else if ( dx < -g_config.flip_distance && m_current_index < m_files.size() - 1
-                    && !_changing && _load_thread.isIdle() )
+                    && !_changing )
         {
             _drag_offset = dx + width();
             _moveForward();
             _changing = true;
         } else if ( dx > g_config.flip_distance && m_current_index > 0
-                    && !_changing && _load_thread.isIdle() )
+                    && !_changing )
         {
             _drag_offset = dx - width();
             _moveBack();
@@ -1084,22 +1132,77 @@ void ScreenViewer::onTimer( void )
 {
     if ( _changing )
     {
-        if ( _drag_offset > 0 )
+        // a new move or swipe set another offset: slide from there, taking
+        // as long as image_scroll_speed pixels per timer tick would
+        if ( !_slide.isRunning() || _drag_offset != _slide_offset )
         {
-            _drag_offset = std::max(_drag_offset - g_config.image_scroll_speed, 0);
-        } else if ( _drag_offset < 0 ) {
-            _drag_offset = std::min(_drag_offset + g_config.image_scroll_speed, 0);
+            _slide_from = _drag_offset;
+            _slide.start( abs(_drag_offset) * g_config.timer_duration
+                          / std::max(g_config.image_scroll_speed, 1),
+                          QEasingCurve::OutQuad );
         }
+        _drag_offset = qRound( _slide_from * ( 1.0 - _slide.progress() ) );
+        _slide_offset = _drag_offset;
         update();
     }
-    if ( _drag_offset == 0 ) _changing = false;
+    if ( _drag_offset == 0 )
+    {
+        _changing = false;
+        _slide.stop();
+    }
+}
 
-    bool load_thread_idle_state = _load_thread.isIdle();
-    if ( load_thread_idle_state != _last_load_thread_idle_state )
+/*******************************************************************************
+ * PRIVATE SLOTS
+ *******************************************************************************/
+
+void ScreenViewer::_onImageLoaded( ImageLoadResult result )
+{
+    if ( result.generation != _load_thread.generation() )
+        return;
+
+    // the file list may have grown since the image was requested
+    int index = result.index;
+    if ( index < 0 || index >= m_files.size() || m_files[index] != result.name )
+        index = DirectoryScanner::find( m_files, result.name );
+
+    // low resolution image of a progressive load, the full one follows
+    if ( result.preview )
     {
-        update();
-        _last_load_thread_idle_state = load_thread_idle_state;
+        ImageWithInfo * i = _slot( index );
+        if ( i != NULL && i->isNull() && i->small_image == NULL )
+        {
+            i->small_image = new QImage( result.image );
+            i->full_size = result.full_size;
+            update();
+        }
+        return;
     }
+
+    _requested.remove( result.name );
+
+    // keep it if it is still near the current image
+    int first, last;
+    _prefetchWindow( first, last );
+    if ( index >= first && index <= last && !result.image.isNull() )
+        _ring.insert( result.name, result.image, result.pyramid );
+
+    // the image may have moved to another slot since it was requested
+    ImageWithInfo * i = _slot( index );
+    if ( i == NULL || !i->isNull() || result.image.isNull() )
+    {
+        update(); // "Loading" may have to become "Cannot load image"
+        return;
+    }
+
+    i->image = new QImage( result.image );
+    if ( !result.pyramid.isNull() )
+        i->pyramid = new ImagePyramid( result.pyramid );
+    delete i->small_image;
+    i->small_image = NULL;
+    // the zoom of an empty slot is meaningless, fit the image when drawn
+    i->zoom = 0.0;
+    update();
 }
 
 /*******************************************************************************
@@ -1111,20 +1214,27 @@ void  ScreenViewer::loadImage( int index, ImageWithInfo &i )
     // Warning: breaking encapsulation here.
     delete i.image;
     delete i.small_image;
+    delete i.pyramid;
 
     i.image = NULL;
+    i.small_image = NULL;
+    i.pyramid = NULL;
     i.zoom = 1.0;
     if ( index < 0 || index >= m_files.size() )
         return;
-
-    ImageLoadItem ili;
-    ili.name = m_files[index];
-    ili.destination = &i.image;
-    ili.w = width();
-    ili.h = height();
     i.zoom = 0.0;
-    ili.force_fit_in_size = false;
-    _load_thread.addLoadImage(ili);
+
+    // prefetched or viewed recently: no decoding, the pixels are shared
+    QImage image;
+    ImagePyramid pyramid;
+    if ( _ring.get( m_files[index], image, pyramid ) )
+    {
+        i.image = new QImage( image );
+        if ( !pyramid.isNull() )
+            i.pyramid = new ImagePyramid( pyramid );
+        return;
+    }
+    _requestImage( index );
 }
 
 void ScreenViewer::resetFitZoom( ImageWithInfo &i, FitZoomMode zoom_mode )
@@ -1264,6 +1374,8 @@ void ScreenViewer::_resetUserActionsParameters( void )
     _committed_posx = _committed_posy = _committed_drag_offset = 0;
     _allow_zoom = _allow_pan = _allow_drag = false;
     _changing = false;
+    _slide.stop();
+    _slide_from = _slide_offset = 0;
     _two_fingers = _two_fingers_valid_operation = false;
 
     m_action.endMouseAction();
@@ -1310,37 +1422,163 @@ void ScreenViewer::commitTouchParams( void )
 
 void ScreenViewer::_reloadAll( void )
 {
-    // wait for load thread to stop
-    // (it may still have pointers to the images)
-    _load_thread.clear();
-    _load_thread.waitUntilIdle();
+    // forget the images being loaded, their results will be dropped
+    _load_thread.cancel();
+    _requested.clear();
 
     loadImage( m_current_index,   _current);
     loadImage( m_current_index-1, _previous);
     loadImage( m_current_index+1, _next);
+    _prefetch();
+}
+
+void ScreenViewer::_requestImage( int index )
+{
+    const QString & name = m_files[index];
+    if ( _requested.contains( name ) )
+        return;
+    _requested.insert( name );
+
+    ImageLoadItem ili;
+    ili.dir = m_dir_name;
+    ili.name = name;
+    ili.build_pyramid = true;
+    ili.index = index;
+    ili.w = width();
+    ili.h = height();
+    ili.force_fit_in_size = false;
+    // the image the user is waiting for is shown in low resolution first
+    ili.progressive = ( index == m_current_index );
+    // nearest first, ahead before behind at the same distance
+    int d = index - m_current_index;
+    ili.priority = ( d * _direction >= 0 ? -2 * qAbs(d) : -2 * qAbs(d) - 1 );
+    _load_thread.addLoadImage(ili);
+}
+
+void ScreenViewer::_drawSmallImage( QPainter & painter, ImageWithInfo & img, int offset )
+{
+    // where the full image will be drawn at the fit zoom
+    int w = img.full_size.width();
+    int h = img.full_size.height();
+    if ( w <= 0 || h <= 0 )
+    {
+        w = img.small_image->width();
+        h = img.small_image->height();
+        ImageLoadThread::fitImage( w, h, width(), height(), false );
+    } else {
+        ImageLoadThread::fitImage( w, h, width(), height(), true );
+    }
+    QRect r( ( width() - w ) / 2 + offset, ( height() - h ) / 2, w, h );
+
+    painter.save();
+    painter.setRenderHint( QPainter::SmoothPixmapTransform, true );
+    painter.drawImage( r, *img.small_image );
+    painter.restore();
+}
+
+ImageWithInfo * ScreenViewer::_slot( int index )
+{
+    if ( index < 0 )
+        return NULL;
+    if ( index == m_current_index )
+        return &_current;
+    if ( index == m_current_index - 1 )
+        return &_previous;
+    if ( index == m_current_index + 1 )
+        return &_next;
+    return NULL;
+}
+
+void ScreenViewer::_prefetchWindow( int & first, int & last )
+{
+    int before = ( _direction > 0 ? g_config.prefetch_behind : g_config.prefetch_ahead );
+    int after = ( _direction > 0 ? g_config.prefetch_ahead : g_config.prefetch_behind );
+    first = qMax( m_current_index - before, 0 );
+    last = qMin( m_current_index + after, m_files.size() - 1 );
+}
+
+void ScreenViewer::_prefetch( void )
+{
+    _ring.setBudget( (qint64)g_config.viewer_memory * 1024 * 1024 );
+
+    // the queued items are requested again with the priorities
+    // of the new position, or dropped if they are out of the window
+    QList<ImageLoadItem> removed = _load_thread.clear();
+    for ( int k = 0; k < removed.size(); k++ )
+        _requested.remove( removed[k].name );
+    if ( m_current_index < 0 || m_current_index >= m_files.size() )
+        return;
+
+    int first, last;
+    _prefetchWindow( first, last );
+    int depth = qMax( m_current_index - first, last - m_current_index );
+
+    // the images of the window are the most recently used (the nearest last)
+    for ( int d = depth; d >= 0; d-- )
+    {
+        if ( m_current_index + d <= last )
+            _ring.touch( m_files[m_current_index + d] );
+        if ( d > 0 && m_current_index - d >= first )
+            _ring.touch( m_files[m_current_index - d] );
+    }
+
+    // request the missing ones while they fit in the budget
+    // (assuming they are about as big as the current image)
+    qint64 image_bytes = _current.isNull() ? 0 : (qint64)_current.image->sizeInBytes();
+    qint64 planned = _ring.bytes();
+    for ( int d = 0; d <= depth; d++ )
+    {
+        for ( int side = 0; side < 2; side++ )
+        {
+            int index = m_current_index + ( side == 0 ? _direction : -_direction ) * d;
+            if ( ( d == 0 && side == 1 ) || index < first || index > last )
+                continue;
+            const QString & name = m_files[index];
+            if ( _ring.contains( name ) )
+                continue;
+
+            // an image shown in a slot is kept as viewed recently
+            ImageWithInfo * slot = _slot( index );
+            if ( slot != NULL && !slot->isNull() )
+            {
+                _ring.insert( name, *slot->image,
+                              slot->pyramid != NULL ? *slot->pyramid : ImagePyramid() );
+                continue;
+            }
+
+            if ( d > 1 && planned + image_bytes > _ring.budget() )
+                continue;
+            planned += image_bytes;
+            _requestImage( index );
+        }
+    }
 }
 
 void ScreenViewer::_moveForward( void )
 {
     m_current_index++;
+    _direction = 1;
     _current.recenter();
 
     _previous = _current;
     _current = _next;
 
     loadImage( m_current_index+1, _next );
+    _prefetch();
     emit indexChanged( m_current_index );
 }
 
 void ScreenViewer::_moveBack( void )
 {
     m_current_index--;
+    _direction = -1;
     _current.recenter();
 
     _next = _current;
     _current = _previous;
 
     loadImage( m_current_index-1, _previous );
+    _prefetch();
     emit indexChanged( m_current_index );
 }
 
@@ -1360,6 +1598,15 @@ QTransform ScreenViewer::_getCurrentTransform( void )
     return tr;
 }
 
+QTransform ScreenViewer::_fitTransform( const QRect & r, ImageWithInfo & img )
+{
+    // maps the image pixels onto r
+    QTransform tr;
+    tr.translate( (qreal)r.x(), (qreal)r.y() );
+    tr.scale( (qreal)r.width() / (qreal)img.width(), (qreal)r.height() / (qreal)img.height() );
+    return tr;
+}
+
 bool ScreenViewer::_isScreenPointInsideCurrentImage( qreal x, qreal y )
 {
     // x,y are the coordinates on the screen
@@ -1444,6 +1691,11 @@ void ScreenViewer::_deleteCurrentFile( void )
     // remove file from vector
     m_files.removeAt(m_current_index);
 
+    // the indexes of the images being loaded are shifted
+    _load_thread.cancel();
+    _requested.clear();
+    _ring.remove( filename );
+
     // Load new images
     if ( m_files.size() >= 0 )
     {
@@ -1461,8 +1713,13 @@ void ScreenViewer::_deleteCurrentFile( void )
                 loadImage( m_current_index+1, _next );
             else
                 _next.clear();
+            if ( _previous.isNull() && m_current_index > 0 )
+                loadImage( m_current_index-1, _previous );
         }
         resetFitZoom(_current);
+        if ( _current.isNull() && m_current_index >= 0 && m_current_index < m_files.size() )
+            loadImage( m_current_index, _current );
+        _prefetch();
     }
     _current.recenter();
     update();
@@ -26,6 +26,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "ImageLoadThread.h"
 #include "TouchUI.h"
 #include "ImageWithInfo.h"
+#include "DisplayCache.h"
+#include "ImageRing.h"
+#include "Animation.h"
 
 /**
  * UI state for viewing an image.
@@ -41,6 +44,10 @@ private:
     int _drag_offset_y; // Distance panned up or down
 
     ImageWithInfo _previous, _current, _next;
+    DisplayCache _display_cache; // smooth rendering of _current at the fit zoom
+    ImageRing _ring; // decoded images around _current (prefetched or viewed recently)
+    QSet<QString> _requested; // files queued or being decoded
+    int _direction; // +1 when browsing forward, -1 backward
 
     bool _show_ui;
     bool _show_ui_by_tap;
@@ -53,10 +60,12 @@ private:
     bool _two_fingers; // only on multitouch mode when a two finger operation starts
     bool _two_fingers_valid_operation; // if the finger operation is valid (inside the image)
     bool _changing; // currently playing the transition animation from one image to another
+    Animation _slide; // the transition, from _slide_from to 0
+    int _slide_from;
+    int _slide_offset; // last offset set by the transition
     bool _commit_pan; // Will we pan after a 1-finger drag or treat it as a swipe?
 
     ImageLoadThread _load_thread;
-    bool _last_load_thread_idle_state; // last idle state viewed by the timer
 
     TouchUI _ui;
     bool _extra_buttons;
@@ -126,10 +135,24 @@ public:
     bool isReady();
     bool isBeingPinchZoomed();
 
+    inline bool isChanging( void ) const
+    {
+        return _changing;
+    }
+
+    inline ImageLoadThread & loadThread( void )
+    {
+        return _load_thread;
+    }
+
 signals:
 
     void fitImage( void );
 
+private slots:
+
+    void _onImageLoaded( ImageLoadResult result );
+
 private:
 
     void _resetUserActionsParameters( void );
@@ -140,10 +163,16 @@ private:
     void _moveForward( void );
     void _moveBack( void );
     void _reloadAll( void );
+    void _requestImage( int index );
+    ImageWithInfo * _slot( int index );
+    void _drawSmallImage( QPainter & painter, ImageWithInfo & img, int offset );
+    void _prefetchWindow( int & first, int & last );
+    void _prefetch( void );
     void _handleTouchAction( TouchUI::UIAction action );
     void _limitZoom( double & zoom, ImageWithInfo & img );
     void _limitPan( void );
     QTransform _getCurrentTransform( void );
+    QTransform _fitTransform( const QRect & r, ImageWithInfo & img );
     bool _isScreenPointInsideCurrentImage( qreal x, qreal y );
     void _loadUI( void );
     void _deleteCurrentFile( void );
@@ -0,0 +1,441 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#include "SelfTest.h"
+#include "ExifReader.h"
+#include "ImageScaler.h"
+#include <QFile>
+#include <QScopedArrayPointer>
+#include <QTemporaryDir>
+#include <string.h>
+#include <stdio.h>
+
+#define SELFTEST_EXIF_MUTATIONS 20000
+#define SELFTEST_FILE_MUTATIONS 2000
+
+// file offset the parsed blocks pretend to start at
+#define SELFTEST_BASE 12
+
+// deterministic, so a failure can be reproduced
+static quint32 s_seed = 12345;
+
+static quint32 nextRandom( void )
+{
+	s_seed = s_seed * 1103515245 + 12345;
+	return s_seed >> 8;
+}
+
+static void put16( QByteArray & a, int pos, quint32 v, bool big_endian )
+{
+	if ( a.size() < pos + 2 ) a.resize( pos + 2 );
+	a[pos + ( big_endian ? 0 : 1 )] = (char)( v >> 8 );
+	a[pos + ( big_endian ? 1 : 0 )] = (char)v;
+}
+
+static void put32( QByteArray & a, int pos, quint32 v, bool big_endian )
+{
+	put16( a, pos + ( big_endian ? 0 : 2 ), v >> 16, big_endian );
+	put16( a, pos + ( big_endian ? 2 : 0 ), v & 0xFFFF, big_endian );
+}
+
+static void putEntry( QByteArray & a, int pos, quint32 tag, quint32 type, quint32 count, quint32 value, bool big_endian )
+{
+	put16( a, pos, tag, big_endian );
+	put16( a, pos + 2, type, big_endian );
+	put32( a, pos + 4, count, big_endian );
+	if ( type == 3 && count == 1 )
+	{
+		put16( a, pos + 8, value, big_endian );
+		put16( a, pos + 10, 0, big_endian );
+	} else {
+		put32( a, pos + 8, value, big_endian );
+	}
+}
+
+int SelfTest::run( void )
+{
+	bool ok = true;
+	ok = _exif() && ok;
+
+	double max_error = 0.0;
+	bool scaler_ok = scaler( max_error );
+	printf( "scaler: max error %.0f, %s\n", max_error, scaler_ok ? "ok" : "FAILED" );
+	ok = scaler_ok && ok;
+
+	return ok ? 0 : 1;
+}
+
+bool SelfTest::scaler( double & max_error )
+{
+	// the last cases reduce by thousands of pixels to one, where rounding
+	// each weight once put the result 40 levels off
+	static const int cases[][4] = {
+		{ 3000, 2000, 256, 171 }, { 1001, 777, 100, 77 }, { 64, 64, 63, 1 },
+		{ 17, 5, 3, 2 }, { 33, 9, 32, 9 }, { 500, 3, 7, 3 }, { 999, 1000, 998, 999 },
+		{ 5000, 1, 1, 1 }, { 20000, 1, 1, 1 }, { 1, 20000, 1, 1 },
+		{ 65535, 2, 3, 1 }, { 2, 65535, 1, 3 }, { 65535, 3, 7, 1 }
+	};
+	bool ok = true;
+	max_error = 0.0;
+	for ( unsigned int c = 0; c < sizeof(cases) / sizeof(cases[0]); c++ )
+	{
+		int w = cases[c][2];
+		int h = cases[c][3];
+		for ( int pattern = 0; pattern < 2; pattern++ )
+		{
+			QImage::Format format = c % 2 ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+			QImage src = pattern ? _checkerImage( cases[c][0], cases[c][1] )
+			                     : noiseImage( cases[c][0], cases[c][1], format );
+			QImage scalar = ImageScaler::downscale( src, w, h, ImageScaler::SCALAR );
+			QImage ref = _referenceDownscale( src, w, h );
+			for ( int y = 0; y < h; y++ )
+			{
+				const uchar * a = scalar.constScanLine( y );
+				const uchar * b = ref.constScanLine( y );
+				for ( int x = 0; x < w * 4; x++ )
+					max_error = qMax( max_error, (double)qAbs( a[x] - b[x] ) );
+			}
+			for ( int k = ImageScaler::SSE2; k < ImageScaler::KERNEL_COUNT; k++ )
+			{
+				ImageScaler::Kernel kernel = (ImageScaler::Kernel)k;
+				if ( ImageScaler::isSupported( kernel ) && ImageScaler::downscale( src, w, h, kernel ) != scalar )
+				{
+					fprintf( stderr, "[ERROR] scaler: %s downscale of %dx%d to %dx%d differs from scalar\n",
+						ImageScaler::kernelName( kernel ), cases[c][0], cases[c][1], w, h );
+					ok = false;
+				}
+			}
+		}
+	}
+	if ( max_error > 1.0 )
+	{
+		fprintf( stderr, "[ERROR] scaler: %.0f levels away from the area average\n", max_error );
+		ok = false;
+	}
+	return ok;
+}
+
+QImage SelfTest::noiseImage( int w, int h, QImage::Format format )
+{
+	QImage img( w, h, format );
+	quint32 seed = 12345;
+	for ( int y = 0; y < h; y++ )
+	{
+		QRgb * line = (QRgb*)img.scanLine( y );
+		for ( int x = 0; x < w; x++ )
+		{
+			seed = seed * 1103515245 + 12345;
+			int a = format == QImage::Format_RGB32 ? 255 : ( seed >> 24 );
+			line[x] = qPremultiply( qRgba( seed >> 8, seed >> 13, seed >> 18, a ) );
+		}
+	}
+	return img;
+}
+
+/*******************************************************************************
+* PRIVATE METHODS
+*******************************************************************************/
+
+bool SelfTest::_exif( void )
+{
+	int inputs = 0;
+	bool ok = true;
+
+	// the valid blocks are read right
+	for ( int be = 0; be < 2; be++ )
+	{
+		QByteArray block = _exifBlock( be );
+		ExifInfo info;
+		if ( !ExifReader::parseExif( (const uchar *)block.constData(), block.size(), SELFTEST_BASE, info )
+			|| info.orientation != 6 || info.width != 4000 || info.height != 3000
+			|| !info.capture_time.isValid() || info.previews.size() != 1
+			|| info.previews[0].offset != SELFTEST_BASE + 154 || info.previews[0].length != 16 )
+		{
+			fprintf( stderr, "[ERROR] exif: the %s block is misread\n", be ? "MM" : "II" );
+			ok = false;
+		}
+	}
+	QByteArray mpf = _mpfBlock();
+	ExifInfo mpf_info;
+	if ( !ExifReader::parseMpf( (const uchar *)mpf.constData(), mpf.size(), SELFTEST_BASE, mpf_info )
+		|| mpf_info.previews.size() != 1 || mpf_info.previews[0].offset != SELFTEST_BASE + 4000
+		|| mpf_info.previews[0].length != 500 )
+	{
+		fprintf( stderr, "[ERROR] exif: the MPF block is misread\n" );
+		ok = false;
+	}
+
+	// hostile structures: IFD loops, offsets and counts out of range
+	struct Patch { int pos; quint32 value; const char * what; };
+	static const Patch patches[] = {
+		{ 58, 8, "IFD1 is IFD0" },
+		{ 8 + 2 + 2 * 12 + 8, 8, "Exif IFD is IFD0" },
+		{ 8 + 2 + 2 * 12 + 8, 0xFFFFFFF0, "Exif IFD out of range" },
+		{ 4, 0xFFFFFFFF, "IFD0 out of range" },
+		{ 4, 168, "IFD0 at the end" },
+		{ 8 + 2 + 1 * 12 + 4, 0xFFFFFFFF, "huge ASCII count" },
+		{ 8 + 2 + 1 * 12 + 8, 0xFFFFFFF0, "ASCII out of range" },
+		{ 104 + 2 + 8, 0xFFFFFFFF, "thumbnail offset out of range" },
+		{ 104 + 2 + 12 + 8, 0xFFFFFFFF, "huge thumbnail length" },
+		{ 104 + 2 + 12 + 8, 17, "thumbnail one byte too long" },
+	};
+	for ( unsigned int p = 0; p < sizeof(patches) / sizeof(patches[0]); p++ )
+	{
+		for ( int be = 0; be < 2; be++ )
+		{
+			QByteArray block = _exifBlock( be );
+			put32( block, patches[p].pos, patches[p].value, be );
+			inputs++;
+			if ( !_parse( block, false ) )
+			{
+				fprintf( stderr, "[ERROR] exif: %s (%s)\n", patches[p].what, be ? "MM" : "II" );
+				ok = false;
+			}
+		}
+	}
+	QByteArray entries = _exifBlock( false );
+	put16( entries, 8, 0xFFFF, false ); // more IFD entries than bytes
+	QByteArray mp_count = mpf;
+	put32( mp_count, 8 + 2 + 4, 0xFFFFFFFF, true ); // MP entries past the end
+	QByteArray mp_offset = mpf;
+	put32( mp_offset, 8 + 2 + 8, 0xFFFFFFF0, true );
+	inputs += 3;
+	if ( !_parse( entries, false ) || !_parse( mp_count, true ) || !_parse( mp_offset, true ) )
+	{
+		fprintf( stderr, "[ERROR] exif: IFD or MP entry count out of range\n" );
+		ok = false;
+	}
+
+	// random truncations and mutations of the valid blocks
+	QByteArray blocks[3] = { _exifBlock( false ), _exifBlock( true ), mpf };
+	for ( int i = 0; i < SELFTEST_EXIF_MUTATIONS && ok; i++ )
+	{
+		int b = i % 3;
+		QByteArray data = blocks[b];
+		switch ( nextRandom() % 3 )
+		{
+			case 0:
+				data.truncate( nextRandom() % data.size() );
+				break;
+			case 1:
+				for ( int k = 1 + nextRandom() % 8; k > 0; k-- )
+					data[nextRandom() % data.size()] = (char)nextRandom();
+				break;
+			default:
+			{
+				// offsets and counts that point at or past the end
+				static const quint32 values[] = { 0, 1, 0x7FFFFFFF, 0xFFFFFFFF, 0xFFFF };
+				quint32 v = nextRandom() % 2 ? values[nextRandom() % 5] : data.size() - 2 + nextRandom() % 5;
+				put32( data, ( nextRandom() % ( data.size() - 3 ) ) & ~1, v, b != 0 );
+				break;
+			}
+		}
+		inputs++;
+		if ( !_parse( data, b == 2 ) )
+		{
+			fprintf( stderr, "[ERROR] exif: mutation %d of block %d gives unusable values\n", i, b );
+			ok = false;
+		}
+	}
+
+	// whole files: every truncation, then garbage in the segments
+	QTemporaryDir tmp;
+	if ( !tmp.isValid() )
+	{
+		fprintf( stderr, "[ERROR] exif: cannot create a temporary folder\n" );
+		return false;
+	}
+	QString name = tmp.path() + "/selftest.jpg";
+	QByteArray jpeg = _jpegFile( blocks[0], mpf );
+	int file_inputs = jpeg.size() + 1 + SELFTEST_FILE_MUTATIONS;
+	for ( int i = 0; i < file_inputs && ok; i++ )
+	{
+		QByteArray data = jpeg;
+		if ( i <= jpeg.size() )
+			data.truncate( i );
+		else
+			for ( int k = 1 + nextRandom() % 4; k > 0; k-- )
+				data[nextRandom() % 200] = (char)( nextRandom() % 2 ? 0xFF : nextRandom() );
+		QFile f( name );
+		if ( !f.open( QIODevice::WriteOnly | QIODevice::Truncate ) || f.write( data ) != data.size() )
+		{
+			fprintf( stderr, "[ERROR] exif: cannot write %s\n", name.toUtf8().data() );
+			return false;
+		}
+		f.close();
+
+		ExifInfo info;
+		bool read = ExifReader::read( name, info );
+		inputs++;
+		if ( !_usable( info, 0, data.size(), false ) || ( i == jpeg.size()
+			&& ( !read || info.orientation != 6 || info.width != 4000 || info.previews.size() != 2 ) ) )
+		{
+			fprintf( stderr, "[ERROR] exif: file input %d is misread\n", i );
+			ok = false;
+		}
+	}
+
+	printf( "exif: %d inputs, %s\n", inputs, ok ? "ok" : "FAILED" );
+	return ok;
+}
+
+QByteArray SelfTest::_exifBlock( bool be )
+{
+	// IFD0 at 8 (orientation, date, Exif IFD), Exif IFD at 62 (date,
+	// pixel size), IFD1 at 104 (thumbnail), date at 134, thumbnail at 154
+	QByteArray a( 170, '\0' );
+	a[0] = a[1] = be ? 'M' : 'I';
+	put16( a, 2, 0x2A, be );
+	put32( a, 4, 8, be );
+
+	put16( a, 8, 4, be );
+	putEntry( a, 10, 0x0112, 3, 1, 6, be );
+	putEntry( a, 22, 0x0132, 2, 20, 134, be );
+	putEntry( a, 34, 0x8769, 4, 1, 62, be );
+	putEntry( a, 46, 0x0131, 2, 4, 0, be );
+	put32( a, 58, 104, be );
+
+	put16( a, 62, 3, be );
+	putEntry( a, 64, 0x9003, 2, 20, 134, be );
+	putEntry( a, 76, 0xA002, 4, 1, 4000, be );
+	putEntry( a, 88, 0xA003, 3, 1, 3000, be );
+	put32( a, 100, 0, be );
+
+	put16( a, 104, 2, be );
+	putEntry( a, 106, 0x0201, 4, 1, 154, be );
+	putEntry( a, 118, 0x0202, 4, 1, 16, be );
+	put32( a, 130, 0, be );
+
+	memcpy( a.data() + 134, "2015:06:01 12:34:56", 20 );
+	a[154] = (char)0xFF; a[155] = (char)0xD8;
+	a[168] = (char)0xFF; a[169] = (char)0xD9;
+	return a;
+}
+
+QByteArray SelfTest::_mpfBlock( void )
+{
+	// one MP Entry tag pointing at two entries: the primary image and a
+	// VGA class preview 4000 bytes further
+	QByteArray a( 58, '\0' );
+	a[0] = a[1] = 'M';
+	put16( a, 2, 0x2A, true );
+	put32( a, 4, 8, true );
+	put16( a, 8, 1, true );
+	putEntry( a, 10, 0xB002, 7, 32, 26, true );
+	put32( a, 22, 0, true );
+	put32( a, 26, 0x030000, true );
+	put32( a, 30, 1000, true );
+	put32( a, 34, 0, true );
+	put32( a, 42, 0x010001, true );
+	put32( a, 46, 500, true );
+	put32( a, 50, 4000, true );
+	return a;
+}
+
+QByteArray SelfTest::_jpegFile( const QByteArray & exif, const QByteArray & mpf )
+{
+	QByteArray a( "\xFF\xD8", 2 );
+	int pos = a.size();
+	a += QByteArray( "\xFF\xE1\0\0Exif\0\0", 10 ) + exif;
+	put16( a, pos + 2, a.size() - pos - 2, true );
+	pos = a.size();
+	a += QByteArray( "\xFF\xE2\0\0MPF\0", 8 ) + mpf;
+	put16( a, pos + 2, a.size() - pos - 2, true );
+	// baseline frame header: 8 bits, 3000 lines, 4000 columns, 3 components
+	a += QByteArray( "\xFF\xC0\x00\x11\x08\x0B\xB8\x0F\xA0\x03\x01\x22\x00\x02\x11\x01\x03\x11\x01", 19 );
+	a += QByteArray( "\xFF\xDA\x00\x02\x12\x34\xFF\xD9", 8 );
+	return a;
+}
+
+bool SelfTest::_parse( const QByteArray & data, bool mpf )
+{
+	// an exact copy, so a read past the end is outside the allocation
+	QScopedArrayPointer<uchar> copy( new uchar[data.size()] );
+	memcpy( copy.data(), data.constData(), data.size() );
+	ExifInfo info;
+	if ( mpf )
+		ExifReader::parseMpf( copy.data(), data.size(), SELFTEST_BASE, info );
+	else
+		ExifReader::parseExif( copy.data(), data.size(), SELFTEST_BASE, info );
+	return _usable( info, SELFTEST_BASE, data.size(), !mpf );
+}
+
+bool SelfTest::_usable( const ExifInfo & info, qint64 base, qint64 size, bool bounded_previews )
+{
+	if ( info.orientation < 1 || info.orientation > 8 )
+		return false;
+	if ( info.width < 0 || info.height < 0 || info.width > 65535 || info.height > 65535 )
+		return false;
+	for ( int i = 0; i < info.previews.size(); i++ )
+	{
+		const ExifPreview & p = info.previews[i];
+		if ( p.offset <= 0 || p.length <= 0 )
+			return false;
+		// the IFD1 thumbnail is inside the Exif block
+		if ( bounded_previews && ( p.offset < base || p.offset + p.length > base + size ) )
+			return false;
+	}
+	return true;
+}
+
+QImage SelfTest::_referenceDownscale( const QImage & image, int w, int h )
+{
+	QImage result( w, h, image.format() );
+	double fx = (double)image.width() / w;
+	double fy = (double)image.height() / h;
+	for ( int y = 0; y < h; y++ )
+	{
+		double y0 = y * fy, y1 = ( y + 1 ) * fy;
+		uchar * out = result.scanLine( y );
+		for ( int x = 0; x < w; x++ )
+		{
+			double x0 = x * fx, x1 = ( x + 1 ) * fx;
+			double sum[4] = { 0, 0, 0, 0 };
+			double area = 0;
+			for ( int j = (int)y0; j < y1 && j < image.height(); j++ )
+			{
+				double cy = qMin( y1, j + 1.0 ) - qMax( y0, (double)j );
+				const uchar * line = image.constScanLine( j );
+				for ( int i = (int)x0; i < x1 && i < image.width(); i++ )
+				{
+					double a = cy * ( qMin( x1, i + 1.0 ) - qMax( x0, (double)i ) );
+					for ( int c = 0; c < 4; c++ )
+						sum[c] += a * line[i * 4 + c];
+					area += a;
+				}
+			}
+			for ( int c = 0; c < 4; c++ )
+				out[x * 4 + c] = (uchar)qRound( sum[c] / area );
+		}
+	}
+	return result;
+}
+
+QImage SelfTest::_checkerImage( int w, int h )
+{
+	QImage img( w, h, QImage::Format_RGB32 );
+	for ( int y = 0; y < h; y++ )
+	{
+		QRgb * line = (QRgb*)img.scanLine( y );
+		for ( int x = 0; x < w; x++ )
+			line[x] = ( x / 3 + y / 3 ) & 1 ? qRgb( 255, 255, 255 ) : qRgb( 0, 0, 0 );
+	}
+	return img;
+}
@@ -0,0 +1,76 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+#include <QByteArray>
+#include <QImage>
+
+struct ExifInfo;
+
+/**
+ * Correctness checks that need no photos and no window (--selftest).
+ *
+ * The EXIF parser is fed damaged and hostile metadata (truncated and
+ * garbage segments, IFD loops, offsets and counts out of range, random
+ * mutations of valid blocks): it must not read outside its input nor
+ * return values the loader cannot use. Build with -fsanitize=address to
+ * also catch reads that only go one byte too far.
+ *
+ * The downscaler is compared with the exact area average, up to
+ * reductions of a few ten thousand pixels to one.
+ */
+
+class SelfTest
+{
+public:
+
+	// runs every check, returns the exit code (1 if one failed)
+	static int run( void );
+
+	// every ImageScaler kernel gives the scalar result to the bit, and that
+	// one stays within one level of the exact area average; errors go to
+	// stderr (--bench runs it too)
+	static bool scaler( double & max_error );
+
+	// random pixels, the same on every call
+	static QImage noiseImage( int w, int h, QImage::Format format );
+
+private:
+
+	static bool _exif( void );
+
+	// valid blocks the fuzzer starts from
+	static QByteArray _exifBlock( bool big_endian );
+	static QByteArray _mpfBlock( void );
+	static QByteArray _jpegFile( const QByteArray & exif, const QByteArray & mpf );
+
+	// parses a copy of exactly size bytes, returns false if the result is not usable
+	static bool _parse( const QByteArray & data, bool mpf );
+	static bool _usable( const ExifInfo & info, qint64 base, qint64 size, bool bounded_previews );
+
+	// area average computed in floating point
+	static QImage _referenceDownscale( const QImage & image, int w, int h );
+	// squares of 3 x 3 black and white pixels, the worst case for coarse weights
+	static QImage _checkerImage( int w, int h );
+};
+
+#endif // SELFTEST_H
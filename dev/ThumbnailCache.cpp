@@ -0,0 +1,157 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#include "ThumbnailCache.h"
+#include "ImageLoadThread.h"
+#include "ImageScaler.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageWriter>
+#include <QStandardPaths>
+#include <QTemporaryFile>
+#include <QUrl>
+
+// thumbnail sizes defined by the specification
+static const int   THUMB_SIZES[] = { 128, 256, 512, 1024 };
+static const char* THUMB_DIRS[]  = { "normal", "large", "x-large", "xx-large" };
+static const int   THUMB_LEVELS  = 4;
+
+QImage * ThumbnailCache::load( const QString & fullname, int w, int h )
+{
+	QFileInfo info( fullname );
+	if ( !info.exists() )
+		return NULL;
+
+	QString uri = _fileUri( info.absoluteFilePath() );
+	QString mtime = QString::number( info.lastModified().toSecsSinceEpoch() );
+	QString name = _hashName( uri );
+	QString base = _cacheDir();
+	int size = ( w > h ? w : h );
+
+	// start with the smallest level that is big enough, then try bigger ones
+	for ( int level = 0; level < THUMB_LEVELS; level++ )
+	{
+		if ( THUMB_SIZES[level] < size && level < THUMB_LEVELS - 1 )
+			continue;
+
+		QImage thumb;
+		if ( !thumb.load( base + "/" + THUMB_DIRS[level] + "/" + name, "PNG" ) )
+			continue;
+		if ( thumb.text("Thumb::URI") != uri || thumb.text("Thumb::MTime") != mtime )
+			continue; // stale or colliding entry
+
+		int tw = thumb.width();
+		int th = thumb.height();
+		ImageLoadThread::fitImage( tw, th, w, h, true );
+		if ( tw != thumb.width() || th != thumb.height() )
+			return new QImage( ImageScaler::downscale( thumb, tw, th ) );
+		return new QImage( thumb );
+	}
+
+	return NULL;
+}
+
+bool ThumbnailCache::save( const QString & fullname, const QImage & thumb, int size )
+{
+	if ( thumb.isNull() )
+		return false;
+
+	QFileInfo info( fullname );
+	QString base = _cacheDir();
+
+	// never create thumbnails of thumbnails
+	if ( info.absoluteFilePath().startsWith( base ) )
+		return false;
+
+	// the smallest level that holds the size (the biggest one beyond it):
+	// load() starts looking there for the same size
+	if ( size <= 0 )
+		return false;
+	int level = 0;
+	while ( level < THUMB_LEVELS - 1 && THUMB_SIZES[level] < size )
+		level++;
+
+	QImage image = thumb;
+	if ( image.width() > THUMB_SIZES[level] || image.height() > THUMB_SIZES[level] )
+	{
+		int w = image.width();
+		int h = image.height();
+		ImageLoadThread::fitImage( w, h, THUMB_SIZES[level], THUMB_SIZES[level], true );
+		image = ImageScaler::downscale( image, qMax( w, 1 ), qMax( h, 1 ) );
+	}
+
+	QString uri = _fileUri( info.absoluteFilePath() );
+	image.setText( "Thumb::URI", uri );
+	image.setText( "Thumb::MTime", QString::number( info.lastModified().toSecsSinceEpoch() ) );
+	image.setText( "Thumb::Size", QString::number( info.size() ) );
+	image.setText( "Software", "MihPhoto" );
+
+	// the specification requires 0700 for the directories
+	QString dir_name = base + "/" + THUMB_DIRS[level];
+	QDir dir( dir_name );
+	if ( !dir.exists() )
+	{
+		if ( !QDir().mkpath( dir_name ) )
+			return false;
+		QFile::setPermissions( base, QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner );
+		QFile::setPermissions( dir_name, QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner );
+	}
+
+	// write to a temporary file (created with 0600) and rename it, so other
+	// programs never see a partially written thumbnail
+	QTemporaryFile tmp( dir_name + "/mihphoto-XXXXXX.png" );
+	tmp.setAutoRemove( false );
+	if ( !tmp.open() )
+		return false;
+	QImageWriter writer( &tmp, "png" );
+	bool ok = writer.write( image );
+	tmp.close();
+
+	QString target = dir_name + "/" + _hashName( uri );
+	if ( ok && !QFile::rename( tmp.fileName(), target ) )
+	{
+		QFile::remove( target );
+		ok = QFile::rename( tmp.fileName(), target );
+	}
+	if ( !ok )
+		QFile::remove( tmp.fileName() );
+	return ok;
+}
+
+QString ThumbnailCache::_cacheDir( void )
+{
+	return QStandardPaths::writableLocation( QStandardPaths::GenericCacheLocation )
+		+ "/thumbnails";
+}
+
+QString ThumbnailCache::_fileUri( const QString & fullname )
+{
+	return QString::fromLatin1( QUrl::fromLocalFile( fullname ).toEncoded() );
+}
+
+QString ThumbnailCache::_hashName( const QString & uri )
+{
+	return QString::fromLatin1(
+		QCryptographicHash::hash( uri.toUtf8(), QCryptographicHash::Md5 ).toHex() )
+		+ ".png";
+}
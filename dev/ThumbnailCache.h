@@ -0,0 +1,53 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QImage>
+#include <QString>
+
+/**
+ * Persistent thumbnail cache following the freedesktop.org thumbnail
+ * specification, so thumbnails are shared with file managers.
+ *
+ * Thumbnails are PNG files in ~/.cache/thumbnails/{normal,large,x-large,xx-large}
+ * named after the MD5 of the file URI. A thumbnail is valid only if its
+ * Thumb::URI and Thumb::MTime keys match the original file.
+ */
+
+class ThumbnailCache
+{
+public:
+
+	// returns a thumbnail that fits in w x h, or NULL if none is cached or it is stale
+	static QImage * load( const QString & fullname, int w, int h );
+
+	// stores a thumbnail that was generated to fit in size x size
+	static bool save( const QString & fullname, const QImage & thumb, int size );
+
+private:
+
+	static QString _cacheDir( void );
+	static QString _fileUri( const QString & fullname );
+	static QString _hashName( const QString & uri );
+};
+
+#endif // THUMBNAILCACHE_H
@@ -0,0 +1,311 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#include "ThumbnailStore.h"
+#include "ImageScaler.h"
+#include <string.h>
+
+// side of the atlas pages, in pixels (16 MB each)
+#define ATLAS_PAGE_SIZE 2048
+
+ThumbnailStore::ThumbnailStore( void )
+{
+	_slot_size = 256;
+	_head = _tail = -1;
+	_frame = 1;
+	_budget = 256 * 1024 * 1024;
+	_resident = 0;
+	_hits = _misses = _evictions = 0;
+}
+
+void ThumbnailStore::reset( int count )
+{
+	_entries.clear();
+	_entries.resize( count );
+	_pages.clear();
+	_head = _tail = -1;
+	_resident = 0;
+}
+
+void ThumbnailStore::remap( const QVector<int> & old_to_new, int count )
+{
+	QVector<Entry> entries( count );
+	for ( int i = 0; i < _entries.size(); i++ )
+	{
+		Entry & n = entries[old_to_new[i]];
+		n = _entries[i];
+		n.prev = n.prev >= 0 ? old_to_new[n.prev] : -1;
+		n.next = n.next >= 0 ? old_to_new[n.next] : -1;
+	}
+	if ( _head >= 0 )
+	{
+		_head = old_to_new[_head];
+		_tail = old_to_new[_tail];
+	}
+	_entries.swap( entries );
+}
+
+const QImage * ThumbnailStore::get( int index, QRect & rect )
+{
+	Entry & e = _entries[index];
+	if ( e.state != RESIDENT )
+	{
+		_misses++;
+		return NULL;
+	}
+
+	_hits++;
+	e.frame = _frame;
+	if ( _head != index )
+	{
+		_unlink( index );
+		_pushFront( index );
+	}
+	QRect r = _slotRect( e.slot, _slot_size );
+	rect = QRect( r.x(), r.y(), e.width, e.height );
+	return &_pages[e.page].image;
+}
+
+void ThumbnailStore::insert( int index, const QImage & image )
+{
+	if ( _entries[index].state == RESIDENT )
+		_release( index );
+	_place( index, image, false );
+}
+
+void ThumbnailStore::setRequested( int index, bool requested )
+{
+	Entry & e = _entries[index];
+	if ( e.state == RESIDENT && e.blurry )
+		e.reload = requested;
+	else if ( requested && e.state == EMPTY )
+		e.state = REQUESTED;
+	else if ( !requested && e.state == REQUESTED )
+		e.state = EMPTY;
+}
+
+void ThumbnailStore::setFailed( int index )
+{
+	Entry & e = _entries[index];
+	if ( e.state != RESIDENT )
+		e.state = FAILED;
+	else
+		e.blurry = e.reload = false; // keep the one we have
+}
+
+void ThumbnailStore::setSlotSize( int side )
+{
+	if ( side != _slot_size )
+		_repack( side );
+}
+
+int ThumbnailStore::slotSizeFor( int cell_side )
+{
+	static const int sizes[] = { 64, 96, 128, 192, 256, 384, 512 };
+	static const int count = sizeof(sizes) / sizeof(sizes[0]);
+	for ( int i = 0; i < count; i++ )
+		if ( cell_side <= sizes[i] )
+			return sizes[i];
+	return sizes[count - 1];
+}
+
+void ThumbnailStore::setBudget( qint64 bytes )
+{
+	_budget = bytes;
+	if ( _pages.size() > _maxPages() )
+		_repack( _slot_size );
+}
+
+/*******************************************************************************
+* PRIVATE METHODS
+*******************************************************************************/
+
+int ThumbnailStore::_maxPages( void ) const
+{
+	qint64 page_bytes = (qint64)ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE * 4;
+	return (int)qMax( _budget / page_bytes, (qint64)1 );
+}
+
+QRect ThumbnailStore::_slotRect( int slot, int slot_size ) const
+{
+	int per_row = ATLAS_PAGE_SIZE / slot_size;
+	return QRect( ( slot % per_row ) * slot_size, ( slot / per_row ) * slot_size,
+		slot_size, slot_size );
+}
+
+bool ThumbnailStore::_allocSlot( int & page, int & slot )
+{
+	while ( true )
+	{
+		for ( int i = 0; i < _pages.size(); i++ )
+		{
+			if ( !_pages[i].free_slots.isEmpty() )
+			{
+				page = i;
+				slot = _pages[i].free_slots.takeLast();
+				return true;
+			}
+		}
+
+		// a new page while the budget allows it (or when every resident
+		// thumbnail is on screen), else the slot of the least recently used
+		if ( _pages.size() < _maxPages() || !_evictOne() )
+		{
+			Page p;
+			p.image = QImage( ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, QImage::Format_ARGB32_Premultiplied );
+			if ( p.image.isNull() )
+				return false;
+			int per_row = ATLAS_PAGE_SIZE / _slot_size;
+			for ( int i = per_row * per_row - 1; i >= 0; i-- )
+				p.free_slots.append( i );
+			_pages.append( p );
+		}
+	}
+}
+
+void ThumbnailStore::_place( int index, const QImage & image, bool blurry )
+{
+	Entry & e = _entries[index];
+	e.blurry = blurry;
+	e.reload = false;
+	e.frame = 0;
+
+	// fit in the slot (small images are not enlarged, the painter does it)
+	QImage thumb = image;
+	if ( thumb.width() > _slot_size || thumb.height() > _slot_size )
+	{
+		double ratio = qMin( (double)_slot_size / thumb.width(), (double)_slot_size / thumb.height() );
+		thumb = ImageScaler::downscale( thumb, qBound( 1, (int)( thumb.width() * ratio ), _slot_size ),
+			qBound( 1, (int)( thumb.height() * ratio ), _slot_size ) );
+	}
+	if ( thumb.format() != QImage::Format_ARGB32_Premultiplied )
+		thumb = thumb.convertToFormat( QImage::Format_ARGB32_Premultiplied );
+
+	int page, slot;
+	if ( thumb.isNull() || !_allocSlot( page, slot ) )
+	{
+		e.state = EMPTY;
+		return;
+	}
+
+	QImage & dst = _pages[page].image;
+	QRect r = _slotRect( slot, _slot_size );
+	int bytes = thumb.width() * 4;
+	for ( int y = 0; y < thumb.height(); y++ )
+		memcpy( dst.scanLine( r.y() + y ) + r.x() * 4, thumb.constScanLine( y ), bytes );
+
+	e.page = page;
+	e.slot = slot;
+	e.width = thumb.width();
+	e.height = thumb.height();
+	e.state = RESIDENT;
+	_resident++;
+	_pushFront( index );
+}
+
+void ThumbnailStore::_release( int index )
+{
+	Entry & e = _entries[index];
+	_unlink( index );
+	_pages[e.page].free_slots.append( e.slot );
+	e.page = e.slot = -1;
+	e.state = EMPTY;
+	e.blurry = e.reload = false;
+	_resident--;
+}
+
+bool ThumbnailStore::_evictOne( void )
+{
+	// the entries drawn in this frame are all in front of the tail
+	if ( _tail < 0 || _entries[_tail].frame == _frame )
+		return false;
+	_release( _tail );
+	_evictions++;
+	return true;
+}
+
+void ThumbnailStore::_repack( int slot_size )
+{
+	// the thumbnails that still fit, most recently used first
+	int per_page = ( ATLAS_PAGE_SIZE / slot_size ) * ( ATLAS_PAGE_SIZE / slot_size );
+	int keep = qMin( _resident, _maxPages() * per_page );
+	QVector<int> order;
+	for ( int i = _head; i >= 0 && order.size() < keep; i = _entries[i].next )
+		order.append( i );
+
+	// copy them out of the old pages, which are released after
+	QVector<QImage> thumbs( order.size() );
+	QVector<bool> blurry( order.size() );
+	for ( int k = 0; k < order.size(); k++ )
+	{
+		const Entry & e = _entries[order[k]];
+		thumbs[k] = _pages[e.page].image.copy( QRect( _slotRect( e.slot, _slot_size ).topLeft(),
+			QSize( e.width, e.height ) ) );
+		// a thumbnail that filled its slot was scaled down to it
+		blurry[k] = e.blurry || ( slot_size > _slot_size && qMax( e.width, e.height ) == _slot_size );
+	}
+
+	for ( int i = 0; i < _entries.size(); i++ )
+	{
+		Entry & e = _entries[i];
+		if ( e.state == RESIDENT )
+		{
+			e.state = EMPTY;
+			e.page = e.slot = -1;
+			e.prev = e.next = -1;
+			e.blurry = e.reload = false;
+		}
+	}
+	_evictions += _resident - order.size();
+	_pages.clear();
+	_head = _tail = -1;
+	_resident = 0;
+	_slot_size = slot_size;
+
+	// least recently used first, so the order of the list is kept
+	for ( int k = order.size() - 1; k >= 0; k-- )
+		_place( order[k], thumbs[k], blurry[k] );
+}
+
+void ThumbnailStore::_unlink( int index )
+{
+	Entry & e = _entries[index];
+	if ( e.prev >= 0 )
+		_entries[e.prev].next = e.next;
+	else
+		_head = e.next;
+	if ( e.next >= 0 )
+		_entries[e.next].prev = e.prev;
+	else
+		_tail = e.prev;
+	e.prev = e.next = -1;
+}
+
+void ThumbnailStore::_pushFront( int index )
+{
+	Entry & e = _entries[index];
+	e.prev = -1;
+	e.next = _head;
+	if ( _head >= 0 )
+		_entries[_head].prev = index;
+	_head = index;
+	if ( _tail < 0 )
+		_tail = index;
+}
@@ -0,0 +1,178 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#ifndef THUMBNAILSTORE_H
+#define THUMBNAILSTORE_H
+
+#include <QImage>
+#include <QRect>
+#include <QVector>
+
+/**
+ * Decoded thumbnails of a folder, kept within a memory budget.
+ *
+ * Thumbnails are packed in square slots of big atlas pages, at about the
+ * size of the grid cells, so a folder costs a few large allocations instead
+ * of one image per file, and neighbouring cells are drawn from the same
+ * buffer. The slots of evicted thumbnails are reused by the next ones.
+ *
+ * Entries are indexed like the file list and linked in least recently used
+ * order. When no slot is free and the pages fill the budget, the least
+ * recently drawn thumbnails are dropped (never the ones drawn in the
+ * current frame) and have to be requested again when they become visible.
+ */
+
+class ThumbnailStore
+{
+public:
+
+	enum State
+	{
+		EMPTY,     // not loaded and not requested
+		REQUESTED, // waiting for the load thread
+		RESIDENT,
+		FAILED     // the file cannot be loaded, don't ask again
+	};
+
+	ThumbnailStore( void );
+
+	// drops everything and makes room for count entries
+	void reset( int count );
+
+	// grows to count entries, moving entry i to old_to_new[i]
+	void remap( const QVector<int> & old_to_new, int count );
+
+	inline int count( void ) const
+	{
+		return _entries.size();
+	}
+
+	inline State state( int index ) const
+	{
+		return (State)_entries[index].state;
+	}
+
+	// true if the thumbnail should be (re)loaded: it is not there, or it
+	// was made for smaller cells and a sharper one was not requested yet
+	inline bool needsLoad( int index ) const
+	{
+		const Entry & e = _entries[index];
+		return e.state == EMPTY || ( e.state == RESIDENT && e.blurry && !e.reload );
+	}
+
+	inline bool isBlurry( int index ) const
+	{
+		return _entries[index].state == RESIDENT && _entries[index].blurry;
+	}
+
+	// starts a new frame: entries returned by get() from now on are pinned
+	inline void beginFrame( void )
+	{
+		_frame++;
+	}
+
+	// returns the atlas page holding the thumbnail (rect is its area
+	// in the page) or NULL, and marks it as recently used
+	const QImage * get( int index, QRect & rect );
+
+	// the image is scaled down to fit in a slot
+	void insert( int index, const QImage & image );
+	void setRequested( int index, bool requested );
+	void setFailed( int index );
+
+	// side of the slots; changing it repacks the thumbnails (the ones
+	// that get bigger slots become blurry until they are loaded again)
+	void setSlotSize( int side );
+
+	inline int slotSize( void ) const
+	{
+		return _slot_size;
+	}
+
+	inline qint64 slotBytes( void ) const
+	{
+		return (qint64)_slot_size * _slot_size * 4;
+	}
+
+	// the slot size for cells of the given size (a few steps, so resizing
+	// the cells does not repack the thumbnails all the time)
+	static int slotSizeFor( int cell_side );
+
+	void setBudget( qint64 bytes );
+
+	inline qint64 budget( void ) const
+	{
+		return _budget;
+	}
+
+	// counters
+	inline qint64 residentBytes( void ) const { return _resident * slotBytes(); }
+	inline int residentCount( void ) const { return _resident; }
+	inline int pageCount( void ) const { return _pages.size(); }
+	inline quint64 hits( void ) const { return _hits; }
+	inline quint64 misses( void ) const { return _misses; }
+	inline quint64 evictions( void ) const { return _evictions; }
+
+private:
+
+	struct Entry
+	{
+		int prev = -1; // towards the most recently used
+		int next = -1; // towards the least recently used
+		quint32 frame = 0;
+		int page = -1;
+		int slot = -1;
+		short width = 0; // size of the thumbnail in its slot
+		short height = 0;
+		char state = EMPTY;
+		bool blurry = false; // packed for smaller cells
+		bool reload = false; // a sharper thumbnail was requested
+	};
+
+	struct Page
+	{
+		QImage image;
+		QVector<int> free_slots;
+	};
+
+	QVector<Entry> _entries;
+	QVector<Page> _pages;
+	int _slot_size;
+	int _head; // most recently used resident entry
+	int _tail; // least recently used resident entry
+	quint32 _frame;
+	qint64 _budget;
+	int _resident;
+	quint64 _hits;
+	quint64 _misses;
+	quint64 _evictions;
+
+	int _maxPages( void ) const;
+	QRect _slotRect( int slot, int slot_size ) const;
+	bool _allocSlot( int & page, int & slot );
+	void _place( int index, const QImage & image, bool blurry );
+	void _release( int index );
+	bool _evictOne( void );
+	void _repack( int slot_size );
+	void _unlink( int index );
+	void _pushFront( int index );
+};
+
+#endif // THUMBNAILSTORE_H
@@ -0,0 +1,147 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#include "Trace.h"
+
+#ifdef MIH_TRACE
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <QTextStream>
+#include <stdio.h>
+
+#define TRACE_BUFFER_EVENTS 65536
+
+struct TraceEvent
+{
+	const char * name; // string literal
+	qint64 start;
+	qint64 duration; // -1 for an instant event
+};
+
+struct TraceBuffer
+{
+	TraceEvent events[TRACE_BUFFER_EVENTS];
+	QAtomicInt count; // events[0..count) are complete
+	QAtomicInt dropped;
+	int tid;
+	QString name;
+};
+
+QAtomicInt Trace::_enabled( 0 );
+
+// every buffer ever created; the mutex is only taken once per thread
+static QMutex s_buffers_mutex;
+static QList<TraceBuffer*> s_buffers;
+static thread_local TraceBuffer * s_buffer = NULL;
+
+static TraceBuffer * thread_buffer( void )
+{
+	if ( s_buffer == NULL )
+	{
+		TraceBuffer * b = new TraceBuffer;
+		bool gui = ( QCoreApplication::instance() != NULL
+			&& QThread::currentThread() == QCoreApplication::instance()->thread() );
+		s_buffers_mutex.lock();
+		b->tid = s_buffers.size() + 1;
+		b->name = gui ? QString( "GUI" ) : QString( "Thread %1" ).arg( b->tid );
+		s_buffers.append( b );
+		s_buffers_mutex.unlock();
+		s_buffer = b;
+	}
+	return s_buffer;
+}
+
+static inline void append( const char * name, qint64 start, qint64 duration )
+{
+	// only this thread writes to its buffer; the release store publishes
+	// the event to save()
+	TraceBuffer * b = thread_buffer();
+	int n = b->count.loadAcquire();
+	if ( n >= TRACE_BUFFER_EVENTS )
+	{
+		b->dropped.fetchAndAddRelaxed( 1 );
+		return;
+	}
+	TraceEvent & e = b->events[n];
+	e.name = name;
+	e.start = start;
+	e.duration = duration;
+	b->count.storeRelease( n + 1 );
+}
+
+void Trace::complete( const char * name, qint64 start, qint64 end )
+{
+	append( name, start, end - start );
+}
+
+void Trace::instant( const char * name )
+{
+	append( name, Metrics::now(), -1 );
+}
+
+void Trace::start( void )
+{
+	_enabled.storeRelaxed( 1 );
+}
+
+bool Trace::save( const QString & file_name )
+{
+	QFile f( file_name );
+	if ( !f.open( QIODevice::WriteOnly | QIODevice::Text ) )
+		return false;
+
+	QTextStream ts( &f );
+	ts << "{\"traceEvents\":[\n";
+	bool first = true;
+	s_buffers_mutex.lock();
+	for ( int i = 0; i < s_buffers.size(); i++ )
+	{
+		TraceBuffer * b = s_buffers[i];
+		ts << ( first ? "" : ",\n" )
+			<< "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->tid
+			<< ",\"args\":{\"name\":\"" << b->name << "\"}}";
+		first = false;
+
+		int n = b->count.loadAcquire();
+		for ( int k = 0; k < n; k++ )
+		{
+			const TraceEvent & e = b->events[k];
+			ts << ",\n{\"name\":\"" << e.name << "\",\"pid\":1,\"tid\":" << b->tid
+				<< ",\"ts\":" << e.start;
+			if ( e.duration >= 0 )
+				ts << ",\"ph\":\"X\",\"dur\":" << e.duration << "}";
+			else
+				ts << ",\"ph\":\"i\",\"s\":\"t\"}";
+		}
+		if ( b->dropped.loadRelaxed() > 0 )
+			fprintf( stderr, "[WARNING] %d trace events of %s were dropped.\n",
+				b->dropped.loadRelaxed(), b->name.toUtf8().data() );
+	}
+	s_buffers_mutex.unlock();
+	ts << "\n]}\n";
+	return ts.status() == QTextStream::Ok;
+}
+
+#endif // MIH_TRACE
@@ -0,0 +1,88 @@
+/*******************************************************************************
+
+MPhoto - Photo viewer for multi-touch devices
+Copyright (C) 2015 Michael Abrahams
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*******************************************************************************/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+ * Timeline of the GUI and loader threads in the Chrome trace-event format
+ * (open the file in chrome://tracing or Perfetto).
+ *
+ * Only built with MIH_TRACE defined (qmake CONFIG+=trace); otherwise the
+ * TRACE_* macros expand to nothing. Every thread appends to its own
+ * fixed-size buffer without locking, events that do not fit are counted
+ * and dropped. Recording starts with Trace::start().
+ */
+
+#ifdef MIH_TRACE
+
+#include <QAtomicInt>
+#include <QString>
+#include "Metrics.h"
+
+class Trace
+{
+public:
+
+	// records a complete event (start and end in Metrics::now() units)
+	static void complete( const char * name, qint64 start, qint64 end );
+	static void instant( const char * name );
+
+	static void start( void );
+	static bool save( const QString & file_name );
+
+	static inline bool enabled( void )
+	{
+		return _enabled.loadRelaxed() != 0;
+	}
+
+	class Scope
+	{
+	public:
+		inline Scope( const char * name ) : _name( name ), _start( enabled() ? Metrics::now() : 0 ) {}
+		inline ~Scope()
+		{
+			if ( enabled() )
+				complete( _name, _start, Metrics::now() );
+		}
+	private:
+		const char * _name;
+		qint64 _start;
+	};
+
+private:
+
+	// read by every thread on every scope, a relaxed load is enough
+	static QAtomicInt _enabled;
+};
+
+#define TRACE_CONCAT2(a,b) a##b
+#define TRACE_CONCAT(a,b) TRACE_CONCAT2(a,b)
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(_trace_scope_, __LINE__)( name )
+#define TRACE_INSTANT(name) do { if ( Trace::enabled() ) Trace::instant( name ); } while ( 0 )
+
+#else
+
+#define TRACE_SCOPE(name) do {} while ( 0 )
+#define TRACE_INSTANT(name) do {} while ( 0 )
+
+#endif // MIH_TRACE
+
+#endif // TRACE_H
@@ -21,8 +21,27 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QApplication>
 #include <QDir>
 #include <QDesktopWidget>
+#include <QTimer>
+#include <string.h>
 #include "Config.h"
 #include "MainWindow.h"
+#include "MetadataIndex.h"
+#include "Benchmark.h"
+#include "SelfTest.h"
+#include "Metrics.h"
+#include "Trace.h"
+
+#ifdef Q_OS_UNIX
+#include <signal.h>
+
+// set by SIGUSR1, the statistics are written from the event loop
+static volatile sig_atomic_t s_stats_requested = 0;
+
+static void request_stats( int )
+{
+	s_stats_requested = 1;
+}
+#endif
 
 void print_console_help( char * appname )
 {
@@ -33,6 +52,16 @@ void print_console_help( char * appname )
 	printf("%-20s - %s\n", "--install-dir=<dir>", "get resource files from <dir> instead of the default directory");
 	printf("%-20s - %s\n", "--multitouch, -m", "enable multitouch support");
 	printf("%-20s - %s\n", "--no-multitouch", "disable multitouch support");
+	printf("%-20s - %s\n", "--bench[=<dir>]", "measure the load pipeline on the images of <dir>");
+	printf("%-20s   %s\n", "", "(or on generated ones) without a window, print JSON");
+	printf("%-20s - %s\n", "--bench-count=<n>", "number of images to generate (default 100)");
+	printf("%-20s - %s\n", "--bench-output=<f>", "write the benchmark report to <f>");
+	printf("%-20s - %s\n", "--selftest", "check the metadata parser on damaged files and the");
+	printf("%-20s   %s\n", "", "downscaler against a reference, exit with 1 if a check fails");
+	printf("%-20s - %s\n", "--stats[=<file>]", "write the load statistics (JSON) to <file> or to the");
+	printf("%-20s   %s\n", "", "standard output at exit, and on SIGUSR1");
+	printf("%-20s - %s\n", "--trace=<file>", "write a Chrome trace of the GUI and loader threads");
+	printf("%-20s   %s\n", "", "to <file> at exit (builds with CONFIG+=trace only)");
 	printf("%-20s - %s\n", "--help, -h", "print this help");
 	printf("%-20s - %s\n", "--version, -v", "print the version number");
 }
@@ -46,6 +75,11 @@ void print_console_version( void )
 
 int main(int argc, char *argv[])
 {
+	// the benchmark and the self-test run without a display
+	for ( int i = 1; i < argc; i++ )
+		if ( strncmp( argv[i], "--bench", 7 ) == 0 || strcmp( argv[i], "--selftest" ) == 0 )
+			qputenv( "QT_QPA_PLATFORM", "offscreen" );
+
 	QApplication app(argc, argv);
 	app.addLibraryPath( app.applicationDirPath() );
 	g_config.load();
@@ -57,6 +91,12 @@ int main(int argc, char *argv[])
 	QStringList args = app.arguments();
 	QString startfile = "";
 	bool fullscreen = true;
+	bool bench = false;
+	bool selftest = false;
+	QString bench_dir, bench_output;
+	int bench_count = 100;
+	QString stats_file;
+	QString trace_file;
 
 	for ( int i = 1; i < args.size(); i++ )
 	{
@@ -71,6 +111,25 @@ int main(int argc, char *argv[])
 			g_config.multitouch = true;
 		else if ( v == "--no-multitouch" )
 			g_config.multitouch = false;
+		else if ( v == "--bench" )
+			bench = true;
+		else if ( v.startsWith("--bench=") )
+		{
+			bench = true;
+			bench_dir = v.mid(8);
+		}
+		else if ( v.startsWith("--bench-count=") )
+			bench_count = qMax( v.mid(14).toInt(), 1 );
+		else if ( v.startsWith("--bench-output=") )
+			bench_output = v.mid(15);
+		else if ( v == "--selftest" )
+			selftest = true;
+		else if ( v == "--stats" )
+			stats_file = "-";
+		else if ( v.startsWith("--stats=") )
+			stats_file = v.mid(8);
+		else if ( v.startsWith("--trace=") )
+			trace_file = v.mid(8);
 		else if ( v == "--help" || v == "-h" )
 		{
 			print_console_help(argv[0]);
@@ -86,6 +145,54 @@ int main(int argc, char *argv[])
 	}
 	g_config.computeUiSize( app.desktop()->logicalDpiX() );
 
+	if ( !trace_file.isEmpty() )
+	{
+#ifdef MIH_TRACE
+		Trace::start();
+#else
+		fprintf( stderr, "[WARNING] --trace needs a build with tracing (qmake CONFIG+=trace)\n" );
+		trace_file = "";
+#endif
+	}
+
+	if ( selftest )
+		return SelfTest::run();
+
+	if ( bench )
+	{
+		int ret = Benchmark::run( bench_dir, bench_output, bench_count );
+#ifdef MIH_TRACE
+		if ( !trace_file.isEmpty() && !Trace::save( trace_file ) )
+			fprintf( stderr, "[WARNING] Cannot write %s\n", trace_file.toUtf8().data() );
+#endif
+		return ret;
+	}
+
 	MainWindow window(startfile, fullscreen);
-	return app.exec();
+
+	QTimer stats_timer;
+#ifdef Q_OS_UNIX
+	if ( !stats_file.isEmpty() )
+	{
+		signal( SIGUSR1, request_stats );
+		QObject::connect( &stats_timer, &QTimer::timeout, [&stats_file]() {
+			if ( s_stats_requested )
+			{
+				s_stats_requested = 0;
+				Metrics::save( stats_file );
+			}
+		} );
+		stats_timer.start( 500 );
+	}
+#endif
+
+	int ret = app.exec();
+	MetadataIndex::flush();
+	if ( !stats_file.isEmpty() && !Metrics::save( stats_file ) )
+		fprintf( stderr, "[WARNING] Cannot write %s\n", stats_file.toUtf8().data() );
+#ifdef MIH_TRACE
+	if ( !trace_file.isEmpty() && !Trace::save( trace_file ) )
+		fprintf( stderr, "[WARNING] Cannot write %s\n", trace_file.toUtf8().data() );
+#endif
+	return ret;
 }